@@ -0,0 +1,240 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compressed-input.h"
+
+using namespace std;
+
+Compression detect_compression(const char* data, size_t size)
+{
+	const unsigned char* p = (const unsigned char*)data;
+
+	if (size >= 2 && p[0]==0x1f && p[1]==0x8b)
+		return COMPRESSION_GZIP;
+	if (size >= 4 && p[0]==0x28 && p[1]==0xb5 && p[2]==0x2f && p[3]==0xfd)
+		return COMPRESSION_ZSTD;
+	return COMPRESSION_NONE;
+}
+
+const char* compression_name(Compression c)
+{
+	switch (c)
+	{
+	case COMPRESSION_GZIP:
+		return "gzip";
+	case COMPRESSION_ZSTD:
+		return "zstd";
+	case COMPRESSION_DEFLATE:
+		return "deflate";
+	default:
+		return "none";
+	}
+}
+
+bool compression_supported(Compression c)
+{
+#ifndef HAVE_ZSTD
+	if (c == COMPRESSION_ZSTD)
+		return false;
+#endif
+	return true;
+}
+
+
+struct Decompressor {
+	Compression compression;
+	const char* in;
+	size_t in_size;
+	size_t in_pos;
+	bool done;
+
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream* zstd;
+#endif
+};
+
+Decompressing_streambuf::Decompressing_streambuf(const char* data, size_t size,
+						 Compression c, size_t block_size) :
+	_d(new Decompressor()), _block(block_size), _failed(false)
+{
+	_d->compression = c;
+	_d->in = data;
+	_d->in_size = size;
+	_d->in_pos = 0;
+	_d->done = false;
+
+	switch (c)
+	{
+	case COMPRESSION_GZIP:
+		memset(&_d->zs, 0, sizeof(_d->zs));
+		// +32: detect gzip/zlib headers automatically
+		if (inflateInit2(&_d->zs, MAX_WBITS + 32) != Z_OK)
+			_failed = true;
+		break;
+
+	case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+		_d->zstd = ZSTD_createDStream();
+		if (!_d->zstd || ZSTD_isError(ZSTD_initDStream(_d->zstd)))
+			_failed = true;
+#else
+		_failed = true;
+#endif
+		break;
+
+	default:
+		_failed = true;
+		break;
+	}
+
+	setg(&_block[0], &_block[0], &_block[0]);
+}
+
+Decompressing_streambuf::~Decompressing_streambuf()
+{
+	if (_d->compression == COMPRESSION_GZIP)
+		inflateEnd(&_d->zs);
+#ifdef HAVE_ZSTD
+	if (_d->compression == COMPRESSION_ZSTD && _d->zstd)
+		ZSTD_freeDStream(_d->zstd);
+#endif
+	delete _d;
+}
+
+Decompressing_streambuf::int_type Decompressing_streambuf::underflow()
+{
+	if (gptr() < egptr())
+		return traits_type::to_int_type(*gptr());
+
+	size_t produced = 0;
+	while (produced == 0 && !_d->done && !_failed) {
+		if (_d->compression == COMPRESSION_GZIP) {
+			z_stream &zs = _d->zs;
+			// zlib's counters are 32-bit, feed it at most 1GB at a time.
+			const size_t avail = min(_d->in_size - _d->in_pos, (size_t)1 << 30);
+			zs.next_in = (Bytef*)(_d->in + _d->in_pos);
+			zs.avail_in = (uInt)avail;
+			zs.next_out = (Bytef*)&_block[0];
+			zs.avail_out = (uInt)_block.size();
+
+			int rc = inflate(&zs, Z_NO_FLUSH);
+			_d->in_pos += avail - zs.avail_in;
+			produced = _block.size() - zs.avail_out;
+
+			if (rc == Z_STREAM_END) {
+				// gzip files may contain several concatenated members
+				if (_d->in_pos < _d->in_size)
+					inflateReset(&zs);
+				else
+					_d->done = true;
+			} else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+				_failed = true;
+			} else if (produced == 0 && rc == Z_BUF_ERROR) {
+				_failed = true; // no progress possible: truncated input
+			}
+		}
+#ifdef HAVE_ZSTD
+		else if (_d->compression == COMPRESSION_ZSTD) {
+			ZSTD_inBuffer in = { _d->in, _d->in_size, _d->in_pos };
+			ZSTD_outBuffer out = { &_block[0], _block.size(), 0 };
+
+			size_t rc = ZSTD_decompressStream(_d->zstd, &out, &in);
+			_d->in_pos = in.pos;
+			produced = out.pos;
+
+			if (ZSTD_isError(rc))
+				_failed = true;
+			else if (_d->in_pos >= _d->in_size && produced < _block.size()) {
+				// rc!=0 means the last frame is incomplete
+				if (rc != 0)
+					_failed = true;
+				_d->done = true;
+			}
+		}
+#endif
+		else {
+			_failed = true;
+		}
+	}
+
+	if (produced == 0)
+		return traits_type::eof();
+
+	setg(&_block[0], &_block[0], &_block[0] + produced);
+	return traits_type::to_int_type(*gptr());
+}
+
+
+bool Step_text::open(const std::string& filename)
+{
+	_inflated.clear();
+	if (!_file.open(filename))
+		return false;
+
+	_compression = detect_compression(_file.data(), _file.size());
+	if (_compression == COMPRESSION_NONE)
+		return true;
+
+	if (!compression_supported(_compression)) {
+		cerr << "Input file '" << filename << "' is " << compression_name(_compression)
+		     << "-compressed, which is not supported by this build" << endl;
+		return false;
+	}
+
+	Decompressing_streambuf buf(_file.data(), _file.size(), _compression);
+	// STEP text usually compresses 5-10x, start with a reasonable guess.
+	_inflated.reserve(_file.size() * 4);
+	const size_t block = 1 << 20;
+	while (true) {
+		const size_t pos = _inflated.size();
+		_inflated.resize(pos + block);
+		const size_t n = (size_t)buf.sgetn(&_inflated[pos], block);
+		_inflated.resize(pos + n);
+		if (n < block)
+			break;
+	}
+
+	if (buf.failed()) {
+		cerr << "Failed to decompress '" << filename << "' (corrupted or truncated "
+		     << compression_name(_compression) << " data)" << endl;
+		return false;
+	}
+
+	_file.close();
+	return true;
+}
+
+const char* Step_text::data() const
+{
+	if (_compression == COMPRESSION_NONE)
+		return _file.data();
+	return _inflated.empty() ? NULL : &_inflated[0];
+}
+
+size_t Step_text::size() const
+{
+	if (_compression == COMPRESSION_NONE)
+		return _file.size();
+	return _inflated.size();
+}
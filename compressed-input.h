@@ -0,0 +1,84 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __COMPRESSED_INPUT__
+#define __COMPRESSED_INPUT__
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "mapped-file.h"
+
+enum Compression {
+	COMPRESSION_NONE,
+	COMPRESSION_GZIP,
+	COMPRESSION_ZSTD,
+	COMPRESSION_DEFLATE    // raw deflate data (zip entries), output only
+};
+
+/* Detect compression from the magic bytes at the start of the data */
+Compression detect_compression(const char* data, size_t size);
+
+const char* compression_name(Compression c);
+
+/* Returns false if the data uses a compression this build doesn't support
+   (zstd is only available when compiled with HAVE_ZSTD). */
+bool compression_supported(Compression c);
+
+
+struct Decompressor;
+
+/* A read-only stream buffer which decompresses an in-memory
+   gzip/zstd buffer on the fly, in blocks of 'block_size' bytes. */
+class Decompressing_streambuf : public std::streambuf {
+	Decompressor* _d;
+	std::vector<char> _block;
+	bool _failed;
+
+	Decompressing_streambuf(const Decompressing_streambuf&);
+	Decompressing_streambuf& operator=(const Decompressing_streambuf&);
+
+protected:
+	virtual int_type underflow();
+
+public:
+	Decompressing_streambuf(const char* data, size_t size, Compression c,
+				size_t block_size = 1 << 20);
+	virtual ~Decompressing_streambuf();
+
+	/* true if the compressed data was corrupted or truncated */
+	bool failed() const { return _failed; };
+};
+
+
+/* The text of a STEP file: memory-mapped as-is if it is not compressed,
+   otherwise decompressed into memory. */
+class Step_text {
+	Mapped_file _file;
+	std::vector<char> _inflated;
+	Compression _compression;
+
+public:
+	Step_text() : _compression(COMPRESSION_NONE) {};
+
+	/* Returns false (and prints an error to STDERR) on failure */
+	bool open(const std::string& filename);
+
+	const char* data() const;
+	size_t size() const;
+	Compression compression() const { return _compression; };
+};
+
+#endif
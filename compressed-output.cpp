@@ -0,0 +1,274 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compressed-output.h"
+
+using namespace std;
+
+/* Maximum number of full blocks waiting for the compression thread.
+   When reached, the formatting thread waits. */
+#define MAX_QUEUED_BLOCKS 4
+
+struct Compressor {
+	Compression compression;
+	streambuf* sink;
+
+	z_stream zs;
+#ifdef HAVE_ZSTD
+	ZSTD_CStream* zstd;
+#endif
+	vector<char> out;
+
+	thread worker;
+	mutex lock;
+	condition_variable cond;
+	deque< vector<char> > queue;
+	vector< vector<char> > free_blocks;
+	bool finishing;
+	atomic<bool> failed;
+
+	// Only accessed by the compression thread until finish()
+	uLong crc;
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+
+	void write_out(size_t n)
+	{
+		if (n && sink->sputn(&out[0], n) != (streamsize)n)
+			failed = true;
+		bytes_out += n;
+	}
+
+	/* Compress one block, or end the stream if 'last' */
+	void compress(const vector<char>& block, bool last)
+	{
+		if (!block.empty())
+			crc = crc32(crc, (const Bytef*)&block[0], (uInt)block.size());
+		bytes_in += block.size();
+
+		if (compression == COMPRESSION_GZIP || compression == COMPRESSION_DEFLATE) {
+			zs.next_in = (Bytef*)(block.empty() ? NULL : &block[0]);
+			zs.avail_in = (uInt)block.size();
+			int rc;
+			do {
+				zs.next_out = (Bytef*)&out[0];
+				zs.avail_out = (uInt)out.size();
+				rc = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+				if (rc == Z_STREAM_ERROR) {
+					failed = true;
+					return;
+				}
+				write_out(out.size() - zs.avail_out);
+			} while (zs.avail_out == 0 || (last && rc != Z_STREAM_END));
+		}
+#ifdef HAVE_ZSTD
+		else if (compression == COMPRESSION_ZSTD) {
+			ZSTD_inBuffer in = { block.empty() ? NULL : &block[0], block.size(), 0 };
+			size_t remaining;
+			do {
+				ZSTD_outBuffer o = { &out[0], out.size(), 0 };
+				remaining = last ? ZSTD_endStream(zstd, &o)
+						 : ZSTD_compressStream(zstd, &o, &in);
+				if (ZSTD_isError(remaining)) {
+					failed = true;
+					return;
+				}
+				write_out(o.pos);
+			} while (last ? remaining != 0 : in.pos < in.size);
+		}
+#endif
+	}
+
+	void run()
+	{
+		while (true) {
+			vector<char> block;
+			{
+				unique_lock<mutex> l(lock);
+				cond.wait(l, [this]{ return !queue.empty() || finishing; });
+				if (queue.empty())
+					break;
+				block.swap(queue.front());
+				queue.pop_front();
+				cond.notify_all();
+			}
+
+			if (!failed)
+				compress(block, false);
+
+			block.clear();
+			unique_lock<mutex> l(lock);
+			free_blocks.push_back(vector<char>());
+			free_blocks.back().swap(block);
+		}
+
+		if (!failed) {
+			compress(vector<char>(), true);
+			if (sink->pubsync() != 0)
+				failed = true;
+		}
+	}
+};
+
+Compressing_streambuf::Compressing_streambuf(std::streambuf* sink, Compression c,
+					     int level, size_t block_size) :
+	_c(new Compressor()), _block(block_size)
+{
+	_c->compression = c;
+	_c->sink = sink;
+	_c->out.resize(1 << 18);
+	_c->finishing = false;
+	_c->failed = false;
+	_c->crc = crc32(0, NULL, 0);
+	_c->bytes_in = 0;
+	_c->bytes_out = 0;
+
+	switch (c)
+	{
+	case COMPRESSION_GZIP:
+	case COMPRESSION_DEFLATE:
+		memset(&_c->zs, 0, sizeof(_c->zs));
+		// +16: write a gzip (not zlib) header, negative: no header at all
+		if (deflateInit2(&_c->zs, level < 0 ? Z_DEFAULT_COMPRESSION : level,
+				 Z_DEFLATED, c == COMPRESSION_GZIP ? MAX_WBITS + 16 : -MAX_WBITS,
+				 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			_c->failed = true;
+		break;
+
+	case COMPRESSION_ZSTD:
+#ifdef HAVE_ZSTD
+		_c->zstd = ZSTD_createCStream();
+		if (!_c->zstd || ZSTD_isError(ZSTD_initCStream(_c->zstd,
+				level < 0 ? ZSTD_CLEVEL_DEFAULT : level)))
+			_c->failed = true;
+#else
+		_c->failed = true;
+#endif
+		break;
+
+	default:
+		_c->failed = true;
+		break;
+	}
+
+	setp(&_block[0], &_block[0] + _block.size());
+	_c->worker = thread(&Compressor::run, _c);
+}
+
+Compressing_streambuf::~Compressing_streambuf()
+{
+	finish();
+
+	if (_c->compression == COMPRESSION_GZIP || _c->compression == COMPRESSION_DEFLATE)
+		deflateEnd(&_c->zs);
+#ifdef HAVE_ZSTD
+	if (_c->compression == COMPRESSION_ZSTD && _c->zstd)
+		ZSTD_freeCStream(_c->zstd);
+#endif
+	delete _c;
+}
+
+/* Hand the current block to the compression thread, and continue
+   with an empty one. */
+void Compressing_streambuf::submit_block()
+{
+	const size_t size = _block.size();
+	_block.resize(pptr() - pbase());
+
+	{
+		unique_lock<mutex> l(_c->lock);
+		_c->cond.wait(l, [this]{ return _c->queue.size() < MAX_QUEUED_BLOCKS; });
+		_c->queue.push_back(vector<char>());
+		_c->queue.back().swap(_block);
+		if (!_c->free_blocks.empty()) {
+			_block.swap(_c->free_blocks.back());
+			_c->free_blocks.pop_back();
+		}
+		_c->cond.notify_all();
+	}
+
+	_block.resize(size);
+	setp(&_block[0], &_block[0] + _block.size());
+}
+
+Compressing_streambuf::int_type Compressing_streambuf::overflow(int_type ch)
+{
+	if (_c->failed || !_c->worker.joinable())
+		return traits_type::eof();
+
+	submit_block();
+
+	if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+	}
+	return traits_type::not_eof(ch);
+}
+
+bool Compressing_streambuf::finish()
+{
+	if (!_c->worker.joinable())
+		return !_c->failed;
+
+	if (pptr() > pbase())
+		submit_block();
+
+	{
+		unique_lock<mutex> l(_c->lock);
+		_c->finishing = true;
+		_c->cond.notify_all();
+	}
+	_c->worker.join();
+	setp(NULL, NULL);
+	return !_c->failed;
+}
+
+unsigned long Compressing_streambuf::input_crc() const
+{
+	return _c->crc;
+}
+
+unsigned long long Compressing_streambuf::input_size() const
+{
+	return _c->bytes_in;
+}
+
+unsigned long long Compressing_streambuf::output_size() const
+{
+	return _c->bytes_out;
+}
+
+Compression parse_compression_name(const char* name)
+{
+	const string n(name);
+	if (n == "gzip" || n == "gz")
+		return COMPRESSION_GZIP;
+	if (n == "zstd" || n == "zst")
+		return COMPRESSION_ZSTD;
+	return COMPRESSION_NONE;
+}
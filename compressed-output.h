@@ -0,0 +1,67 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __COMPRESSED_OUTPUT__
+#define __COMPRESSED_OUTPUT__
+
+#include <cstddef>
+#include <streambuf>
+#include <vector>
+
+#include "compressed-input.h"
+
+struct Compressor;
+
+/* A write-only stream buffer which compresses (gzip/zstd/raw deflate)
+   everything written to it, and writes the compressed data to 'sink'.
+
+   The formatting thread only fills blocks of 'block_size' bytes; full blocks
+   are compressed and written by a separate thread, so formatting and
+   compression run in parallel.
+
+   sync() (e.g. std::endl) does NOT flush the compressor - that would
+   ruin the compression ratio. Call finish() to complete the stream. */
+class Compressing_streambuf : public std::streambuf {
+	Compressor* _c;
+	std::vector<char> _block;
+
+	Compressing_streambuf(const Compressing_streambuf&);
+	Compressing_streambuf& operator=(const Compressing_streambuf&);
+
+	void submit_block();
+
+protected:
+	virtual int_type overflow(int_type ch);
+
+public:
+	/* level<0 selects the library's default compression level */
+	Compressing_streambuf(std::streambuf* sink, Compression c, int level = -1,
+			      size_t block_size = 1 << 20);
+	virtual ~Compressing_streambuf();
+
+	/* Compress the remaining data, write the stream trailer and flush the sink.
+	   Returns false if compression or writing failed at any point. */
+	bool finish();
+
+	/* After finish(): CRC-32 and size of the uncompressed data,
+	   and size of the compressed data (e.g. for zip headers) */
+	unsigned long input_crc() const;
+	unsigned long long input_size() const;
+	unsigned long long output_size() const;
+};
+
+/* Parse a --compress argument ("gzip", "gz", "zstd", "zst").
+   Returns COMPRESSION_NONE for unknown names. */
+Compression parse_compression_name(const char* name);
+
+#endif
@@ -0,0 +1,575 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include <gp_Pnt.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+#include "decimate.h"
+#include "parallel.h"
+
+using namespace std;
+
+/* Below this many triangles per thread, the slabs are not worth it */
+#define MIN_SLAB_TRIANGLES 20000
+
+/* Symmetric 4x4 matrix of the squared distance from a set of planes */
+struct Quadric {
+	double a[10];
+
+	Quadric() { memset(a, 0, sizeof(a)); };
+
+	void add_plane(const double n[3], double d)
+		{
+			a[0] += n[0]*n[0]; a[1] += n[0]*n[1]; a[2] += n[0]*n[2]; a[3] += n[0]*d;
+			a[4] += n[1]*n[1]; a[5] += n[1]*n[2]; a[6] += n[1]*d;
+			a[7] += n[2]*n[2]; a[8] += n[2]*d;
+			a[9] += d*d;
+		}
+
+	Quadric operator+(const Quadric& o) const
+		{
+			Quadric q;
+			for (int i=0;i<10;++i)
+				q.a[i] = a[i] + o.a[i];
+			return q;
+		}
+
+	double error(const double p[3]) const
+		{
+			const double x = p[0], y = p[1], z = p[2];
+			return a[0]*x*x + 2*a[1]*x*y + 2*a[2]*x*z + 2*a[3]*x
+				+ a[4]*y*y + 2*a[5]*y*z + 2*a[6]*y
+				+ a[7]*z*z + 2*a[8]*z + a[9];
+		}
+
+	/* The point of minimal error, false if it is not well defined
+	   (e.g. all planes parallel) */
+	bool optimum(double p[3]) const
+		{
+			const double det = a[0]*(a[4]*a[7] - a[5]*a[5])
+				- a[1]*(a[1]*a[7] - a[5]*a[2])
+				+ a[2]*(a[1]*a[5] - a[4]*a[2]);
+			const double scale = a[0] + a[4] + a[7];
+			if (!(fabs(det) > 1e-9 * scale * scale * scale))
+				return false;
+			// Cramer's rule for A*p = -b
+			const double b0 = -a[3], b1 = -a[6], b2 = -a[8];
+			p[0] = (b0*(a[4]*a[7] - a[5]*a[5]) - a[1]*(b1*a[7] - a[5]*b2)
+				+ a[2]*(b1*a[5] - a[4]*b2)) / det;
+			p[1] = (a[0]*(b1*a[7] - b2*a[5]) - b0*(a[1]*a[7] - a[5]*a[2])
+				+ a[2]*(a[1]*b2 - b1*a[2])) / det;
+			p[2] = (a[0]*(a[4]*b2 - a[5]*b1) - a[1]*(a[1]*b2 - b1*a[2])
+				+ b0*(a[1]*a[5] - a[4]*a[2])) / det;
+			return true;
+		}
+};
+
+enum Vertex_kind {
+	VERTEX_INTERIOR,    // inside one STEP face
+	VERTEX_EDGE,        // on the edge between two faces (with keep_face_edges)
+	VERTEX_FIXED        // corner, open or non-manifold edge: never removed
+};
+
+struct Vertex {
+	double p[3];
+	Quadric q;
+	std::vector<uint32_t> tris;   // can include removed triangles
+	uint32_t version;             // changes invalidate queued collapses
+	Vertex_kind kind;
+	size_t faces[2];              // the faces of a VERTEX_EDGE
+	unsigned slab;
+	bool locked;                  // on a seam between slabs
+	bool removed;
+};
+
+struct Tri {
+	uint32_t v[3];
+	size_t face;
+	bool removed;
+};
+
+struct Collapse {
+	double cost;
+	uint32_t from, to;            // 'from' is removed, 'to' moves to 'pos'
+	uint32_t from_version, to_version;
+	double pos[3];
+
+	bool operator<(const Collapse& o) const { return cost > o.cost; };   // cheapest first
+};
+
+class Decimator {
+	std::vector<Vertex> _v;
+	std::vector<Tri> _t;              // in face order
+	std::vector<Mesh_face> _faces;
+	bool _keep_face_edges;
+	double _max_cost;
+
+	void neighbors(uint32_t a, std::vector<uint32_t>& out) const;
+	bool evaluate(uint32_t a, uint32_t b, Collapse& c) const;
+	bool allowed(const Collapse& c) const;
+	bool flips(uint32_t moved, uint32_t other, const double pos[3]) const;
+	size_t collapse(const Collapse& c);
+	void queue_edges(uint32_t a, unsigned slab, bool whole,
+			 std::priority_queue<Collapse>& heap) const;
+
+public:
+	Decimator(const Indexed_mesh& mesh, const Decimate_options& opts);
+
+	/* Decimate the triangles of 'slab' (whole=false, only
+	   vertices not on seams), or of the whole mesh, until 'live' drops to
+	   'target' or no collapse is cheap enough */
+	void run(unsigned slab, bool whole, size_t live, size_t target);
+
+	/* Assign the vertices to 'count' slabs, and lock those on the seams.
+	   Returns the number of triangles within each slab. */
+	std::vector<size_t> split_slabs(unsigned count);
+	void merge_slabs();
+	size_t live_triangles() const;
+
+	void write_faces(Face_vector& faces) const;
+};
+
+static void triangle_normal(const double* p0, const double* p1, const double* p2, double n[3])
+{
+	const double u[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+	const double w[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+	n[0] = u[1]*w[2] - u[2]*w[1];
+	n[1] = u[2]*w[0] - u[0]*w[2];
+	n[2] = u[0]*w[1] - u[1]*w[0];
+}
+
+static uint64_t edge_key(uint32_t a, uint32_t b)
+{
+	return (a < b) ? ((uint64_t)a << 32 | b) : ((uint64_t)b << 32 | a);
+}
+
+Decimator::Decimator(const Indexed_mesh& mesh, const Decimate_options& opts) :
+	_v(mesh.vertices.size()), _t(mesh.triangles()), _faces(mesh.faces),
+	_keep_face_edges(opts.keep_face_edges),
+	_max_cost(opts.max_error > 0 ? opts.max_error * opts.max_error : HUGE_VAL)
+{
+	for (size_t i=0;i<_v.size();++i) {
+		Vertex &v = _v[i];
+		v.p[0] = mesh.vertices[i].x();
+		v.p[1] = mesh.vertices[i].y();
+		v.p[2] = mesh.vertices[i].z();
+		v.version = 0;
+		v.kind = VERTEX_INTERIOR;
+		v.faces[0] = v.faces[1] = 0;
+		v.slab = 0;
+		v.locked = false;
+		v.removed = false;
+	}
+
+	for (size_t f=0;f<mesh.faces.size();++f) {
+		const Mesh_face &mf = mesh.faces[f];
+		for (size_t i=mf.first;i<mf.first+mf.count;++i) {
+			Tri &t = _t[i];
+			for (int k=0;k<3;++k)
+				t.v[k] = mesh.indices[i*3+k];
+			t.face = f;
+			t.removed = false;
+		}
+	}
+
+	unordered_map<uint64_t, unsigned> edge_uses;
+	edge_uses.reserve(_t.size() * 3 / 2);
+	for (uint32_t i=0;i<_t.size();++i) {
+		Tri &t = _t[i];
+		if (t.v[0] == t.v[1] || t.v[1] == t.v[2] || t.v[0] == t.v[2]) {
+			t.removed = true;
+			continue;
+		}
+		double n[3];
+		triangle_normal(_v[t.v[0]].p, _v[t.v[1]].p, _v[t.v[2]].p, n);
+		const double len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+		if (len > 0) {
+			n[0] /= len; n[1] /= len; n[2] /= len;
+			const double* p = _v[t.v[0]].p;
+			const double d = -(n[0]*p[0] + n[1]*p[1] + n[2]*p[2]);
+			for (int k=0;k<3;++k)
+				_v[t.v[k]].q.add_plane(n, d);
+		}
+		for (int k=0;k<3;++k) {
+			Vertex &v = _v[t.v[k]];
+			v.tris.push_back(i);
+			++edge_uses[edge_key(t.v[k], t.v[(k+1)%3])];
+
+			// Faces around the vertex: one, two (an edge) or more (a corner)
+			if (!_keep_face_edges || v.kind == VERTEX_FIXED)
+				continue;
+			if (v.tris.size() == 1)
+				v.faces[0] = t.face;
+			else if (v.kind == VERTEX_INTERIOR && t.face != v.faces[0]) {
+				v.kind = VERTEX_EDGE;
+				v.faces[1] = t.face;
+			}
+			else if (v.kind == VERTEX_EDGE && t.face != v.faces[0] && t.face != v.faces[1])
+				v.kind = VERTEX_FIXED;
+		}
+	}
+	for (auto &v : _v)
+		if (v.kind == VERTEX_EDGE && v.faces[0] > v.faces[1])
+			swap(v.faces[0], v.faces[1]);
+
+	// The ends of open and non-manifold edges stay in place
+	for (auto &e : edge_uses) {
+		if (e.second != 2) {
+			_v[e.first >> 32].kind = VERTEX_FIXED;
+			_v[e.first & 0xFFFFFFFF].kind = VERTEX_FIXED;
+		}
+	}
+}
+
+void Decimator::neighbors(uint32_t a, std::vector<uint32_t>& out) const
+{
+	out.clear();
+	for (auto ti : _v[a].tris) {
+		const Tri &t = _t[ti];
+		if (t.removed)
+			continue;
+		for (int k=0;k<3;++k)
+			if (t.v[k] != a && find(out.begin(), out.end(), t.v[k]) == out.end())
+				out.push_back(t.v[k]);
+	}
+}
+
+/* Would moving 'moved' to 'pos' flip or degenerate one of its triangles
+   (other than those shared with 'other', which are removed)? */
+bool Decimator::flips(uint32_t moved, uint32_t other, const double pos[3]) const
+{
+	for (auto ti : _v[moved].tris) {
+		const Tri &t = _t[ti];
+		if (t.removed || t.v[0] == other || t.v[1] == other || t.v[2] == other)
+			continue;
+		const double* before[3];
+		const double* after[3];
+		for (int k=0;k<3;++k) {
+			before[k] = _v[t.v[k]].p;
+			after[k] = (t.v[k] == moved) ? pos : before[k];
+		}
+		double n0[3], n1[3];
+		triangle_normal(before[0], before[1], before[2], n0);
+		triangle_normal(after[0], after[1], after[2], n1);
+		const double dot = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+		const double len0 = n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2];
+		const double len1 = n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2];
+		// Flipped, or turned by more than ~60 degrees
+		if (dot <= 0 || dot * dot < 0.25 * len0 * len1)
+			return true;
+	}
+	return false;
+}
+
+/* The cheapest way to collapse the edge a-b, false if it can't be collapsed */
+bool Decimator::evaluate(uint32_t a, uint32_t b, Collapse& c) const
+{
+	const Vertex &va = _v[a], &vb = _v[b];
+	if (va.removed || vb.removed || va.locked || vb.locked)
+		return false;
+
+	const Quadric q = va.q + vb.q;
+	const Vertex_kind ka = va.kind, kb = vb.kind;
+
+	if (ka == VERTEX_INTERIOR && kb == VERTEX_INTERIOR) {
+		c.from = a;
+		c.to = b;
+		if (!q.optimum(c.pos)) {
+			// Pick the best of the ends and the middle
+			const double mid[3] = { (va.p[0]+vb.p[0])/2, (va.p[1]+vb.p[1])/2, (va.p[2]+vb.p[2])/2 };
+			const double* best = va.p;
+			if (q.error(vb.p) < q.error(best))
+				best = vb.p;
+			if (q.error(mid) < q.error(best))
+				best = mid;
+			memcpy(c.pos, best, sizeof(c.pos));
+		}
+	}
+	else if (ka == VERTEX_INTERIOR || kb == VERTEX_INTERIOR) {
+		// Into the vertex on the edge/corner, which stays where it is
+		c.from = (ka == VERTEX_INTERIOR) ? a : b;
+		c.to = (ka == VERTEX_INTERIOR) ? b : a;
+		memcpy(c.pos, _v[c.to].p, sizeof(c.pos));
+	}
+	else if (ka == VERTEX_EDGE && kb == VERTEX_EDGE
+		 && va.faces[0] == vb.faces[0] && va.faces[1] == vb.faces[1]) {
+		// Along the edge between the two faces (checked in allowed())
+		const bool a_to_b = q.error(vb.p) <= q.error(va.p);
+		c.from = a_to_b ? a : b;
+		c.to = a_to_b ? b : a;
+		memcpy(c.pos, _v[c.to].p, sizeof(c.pos));
+	}
+	else if ((ka == VERTEX_EDGE && kb == VERTEX_FIXED) || (ka == VERTEX_FIXED && kb == VERTEX_EDGE)) {
+		// Into the corner at the end of the face edge
+		c.from = (ka == VERTEX_EDGE) ? a : b;
+		c.to = (ka == VERTEX_EDGE) ? b : a;
+		memcpy(c.pos, _v[c.to].p, sizeof(c.pos));
+	}
+	else
+		return false;
+
+	c.cost = max(0.0, q.error(c.pos));
+	c.from_version = _v[c.from].version;
+	c.to_version = _v[c.to].version;
+	return true;
+}
+
+/* Checks which depend on the current neighborhood of the edge */
+bool Decimator::allowed(const Collapse& c) const
+{
+	// The edge must be shared by exactly two triangles...
+	size_t shared = 0;
+	bool face_edge = false;
+	size_t shared_face = 0;
+	for (auto ti : _v[c.from].tris) {
+		const Tri &t = _t[ti];
+		if (t.removed || (t.v[0] != c.to && t.v[1] != c.to && t.v[2] != c.to))
+			continue;
+		if (shared > 0 && t.face != shared_face)
+			face_edge = true;
+		shared_face = t.face;
+		++shared;
+	}
+	if (shared != 2)
+		return false;
+
+	// ...vertices on face edges merge only along the face edge
+	if (_v[c.from].kind == VERTEX_EDGE && !face_edge)
+		return false;
+
+	// ...and the two vertices have no other common neighbors (link condition)
+	vector<uint32_t> na, nb;
+	neighbors(c.from, na);
+	neighbors(c.to, nb);
+	size_t common = 0;
+	for (auto n : na)
+		if (find(nb.begin(), nb.end(), n) != nb.end())
+			++common;
+	if (common != 2)
+		return false;
+
+	return !flips(c.from, c.to, c.pos) && !flips(c.to, c.from, c.pos);
+}
+
+/* Returns the number of triangles removed */
+size_t Decimator::collapse(const Collapse& c)
+{
+	Vertex &from = _v[c.from], &to = _v[c.to];
+	size_t removed = 0;
+
+	for (auto ti : from.tris) {
+		Tri &t = _t[ti];
+		if (t.removed)
+			continue;
+		if (t.v[0] == c.to || t.v[1] == c.to || t.v[2] == c.to) {
+			t.removed = true;
+			++removed;
+			continue;
+		}
+		for (int k=0;k<3;++k)
+			if (t.v[k] == c.from)
+				t.v[k] = c.to;
+		to.tris.push_back(ti);
+	}
+
+	// Drop the removed triangles from the list of 'to'
+	size_t n = 0;
+	for (auto ti : to.tris)
+		if (!_t[ti].removed)
+			to.tris[n++] = ti;
+	to.tris.resize(n);
+
+	memcpy(to.p, c.pos, sizeof(to.p));
+	to.q = to.q + from.q;
+	++to.version;
+
+	from.removed = true;
+	vector<uint32_t>().swap(from.tris);
+	return removed;
+}
+
+void Decimator::queue_edges(uint32_t a, unsigned slab, bool whole,
+			    std::priority_queue<Collapse>& heap) const
+{
+	vector<uint32_t> nb;
+	neighbors(a, nb);
+	for (auto b : nb) {
+		if (!whole && _v[b].slab != slab)
+			continue;
+		Collapse c;
+		if (evaluate(a, b, c) && c.cost <= _max_cost)
+			heap.push(c);
+	}
+}
+
+void Decimator::run(unsigned slab, bool whole, size_t live, size_t target)
+{
+	priority_queue<Collapse> heap;
+	for (uint32_t a=0;a<_v.size();++a) {
+		// (other slabs are being modified by other threads)
+		if ((!whole && _v[a].slab != slab) || _v[a].removed)
+			continue;
+		vector<uint32_t> nb;
+		neighbors(a, nb);
+		for (auto b : nb) {
+			// Every edge once
+			if (b < a || (!whole && _v[b].slab != slab))
+				continue;
+			Collapse c;
+			if (evaluate(a, b, c) && c.cost <= _max_cost)
+				heap.push(c);
+		}
+	}
+
+	while (live > target && !heap.empty()) {
+		const Collapse c = heap.top();
+		heap.pop();
+		if (_v[c.from].removed || _v[c.to].removed
+		    || _v[c.from].version != c.from_version || _v[c.to].version != c.to_version)
+			continue;   // outdated
+		if (!allowed(c))
+			continue;
+		live -= min(live, collapse(c));
+		queue_edges(c.to, slab, whole, heap);
+	}
+}
+
+std::vector<size_t> Decimator::split_slabs(unsigned count)
+{
+	// Along the longest side of the bounding box, with equal numbers of vertices
+	double lo[3] = { HUGE_VAL, HUGE_VAL, HUGE_VAL }, hi[3] = { -HUGE_VAL, -HUGE_VAL, -HUGE_VAL };
+	for (auto &v : _v)
+		for (int k=0;k<3;++k) {
+			lo[k] = min(lo[k], v.p[k]);
+			hi[k] = max(hi[k], v.p[k]);
+		}
+	int axis = 0;
+	for (int k=1;k<3;++k)
+		if (hi[k] - lo[k] > hi[axis] - lo[axis])
+			axis = k;
+
+	vector<double> coords;
+	coords.reserve(_v.size());
+	for (auto &v : _v)
+		coords.push_back(v.p[axis]);
+	vector<double> splits;
+	for (unsigned s=1;s<count;++s) {
+		auto nth = coords.begin() + coords.size() * s / count;
+		nth_element(coords.begin(), nth, coords.end());
+		splits.push_back(*nth);
+	}
+	sort(splits.begin(), splits.end());
+
+	for (auto &v : _v)
+		v.slab = (unsigned)(upper_bound(splits.begin(), splits.end(), v.p[axis]) - splits.begin());
+
+	// Vertices of triangles across slabs are left for the final pass
+	vector<size_t> triangles(count, 0);
+	for (auto &t : _t) {
+		if (t.removed)
+			continue;
+		const unsigned s = _v[t.v[0]].slab;
+		if (_v[t.v[1]].slab != s || _v[t.v[2]].slab != s) {
+			for (int k=0;k<3;++k)
+				_v[t.v[k]].locked = true;
+		}
+		else
+			++triangles[s];
+	}
+	return triangles;
+}
+
+void Decimator::merge_slabs()
+{
+	for (auto &v : _v) {
+		v.slab = 0;
+		v.locked = false;
+	}
+}
+
+size_t Decimator::live_triangles() const
+{
+	size_t n = 0;
+	for (auto &t : _t)
+		if (!t.removed)
+			++n;
+	return n;
+}
+
+void Decimator::write_faces(Face_vector& faces) const
+{
+	std::shared_ptr<Triangle_arena> arena(new Triangle_arena());
+	arena->reserve(live_triangles());
+
+	Face_vector out;
+	out.reserve(faces.size());
+	for (size_t f=0;f<faces.size();++f) {
+		const Mesh_face &mf = _faces[f];
+		size_t count = 0;
+		for (size_t i=mf.first;i<mf.first+mf.count;++i)
+			count += !_t[i].removed;
+
+		// Faces are created just before their triangles, to fill the arena in order
+		Face nf(arena);
+		nf.set_origin(faces[f].origin());
+		nf.set_solid(faces[f].solid());
+		nf.reserve(count);
+		for (size_t i=mf.first;i<mf.first+mf.count;++i) {
+			const Tri &t = _t[i];
+			if (t.removed)
+				continue;
+			const double* p0 = _v[t.v[0]].p;
+			const double* p1 = _v[t.v[1]].p;
+			const double* p2 = _v[t.v[2]].p;
+			nf.addTriangle(Triangle(Point(p0[0], p0[1], p0[2]),
+						Point(p1[0], p1[1], p1[2]),
+						Point(p2[0], p2[1], p2[2])));
+		}
+		out.push_back(nf);
+	}
+
+	faces.swap(out);
+}
+
+size_t decimate_faces(Face_vector& faces, const Decimate_options& opts)
+{
+	Decimator d(build_indexed_mesh(faces), opts);
+
+	const size_t live = d.live_triangles();
+	const size_t target = (size_t)(live * max(0.0, opts.ratio));
+
+	const unsigned slabs = (unsigned)min<size_t>(opts.threads, live / MIN_SLAB_TRIANGLES);
+	if (slabs > 1) {
+		// The slabs only go part of the way: decimating them fully around
+		// their fixed seams leaves long thin triangles for the final pass
+		const vector<size_t> triangles = d.split_slabs(slabs);
+		parallel_for(slabs, slabs, [&](size_t s) {
+			d.run((unsigned)s, false, triangles[s], (size_t)(triangles[s] * sqrt(max(0.0, opts.ratio))));
+		});
+		d.merge_slabs();
+	}
+
+	d.run(0, true, d.live_triangles(), target);
+	d.write_faces(faces);
+	return d.live_triangles();
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __DECIMATE__
+#define __DECIMATE__
+
+#include <cstddef>
+
+struct Decimate_options {
+	double ratio;             // keep this fraction of the triangles (0 = no limit)
+	double max_error;         // don't move the surface further than this (0 = no limit)
+	bool keep_face_edges;     // the edges between STEP faces stay where they are
+	unsigned threads;
+
+	Decimate_options() : ratio(0), max_error(0), keep_face_edges(false), threads(1) {};
+};
+
+/* Reduce the number of triangles by collapsing edges, cheapest first by
+   the quadric error metric (sum of squared distances from the planes of
+   the original triangles), on the welded mesh.
+
+   Collapses which would change the topology (link condition) or flip a
+   triangle are skipped, and open/non-manifold edges are kept, so a
+   watertight mesh stays watertight. Every triangle stays in its STEP face;
+   with keep_face_edges the vertices on the edges between faces are only
+   merged along those edges, and the corners of the faces are kept.
+
+   With threads>1 (and a large mesh) most of the collapses are done in
+   parallel, in slabs along the longest side of the bounding box (the
+   vertices on the seams are kept), and the mesh is finished as a whole.
+
+   Returns the number of triangles left. */
+size_t decimate_faces(Face_vector& faces, const Decimate_options& opts);
+
+#endif
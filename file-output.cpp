@@ -0,0 +1,235 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "file-output.h"
+
+using namespace std;
+
+#define PAGE_ALIGNMENT 4096
+
+/* Writes at least this large bypass the buffer (see xsputn) */
+#define DIRECT_WRITE_SIZE (256 * 1024)
+
+File_streambuf::File_streambuf(size_t chunk_size) :
+	_buf(NULL), _buf_size(chunk_size), _fd(-1), _written(0),
+	_preallocated(false), _failed(false)
+{
+	/* Keep whole (page-aligned) pages, so the chunk writes are whole pages:
+	   their file offsets stay page-aligned until a direct write (see xsputn)
+	   of any size. */
+	_buf_size = max((size_t)PAGE_ALIGNMENT,
+			(_buf_size + PAGE_ALIGNMENT - 1) / PAGE_ALIGNMENT * PAGE_ALIGNMENT);
+#ifdef _WIN32
+	_buf = (char*)_aligned_malloc(_buf_size, PAGE_ALIGNMENT);
+#else
+	void* p = NULL;
+	if (posix_memalign(&p, PAGE_ALIGNMENT, _buf_size) == 0)
+		_buf = (char*)p;
+#endif
+	if (!_buf)
+		throw bad_alloc();
+	setp(_buf, _buf + _buf_size);
+}
+
+File_streambuf::~File_streambuf()
+{
+	close();
+#ifdef _WIN32
+	_aligned_free(_buf);
+#else
+	free(_buf);
+#endif
+}
+
+bool File_streambuf::open(const std::string& filename)
+{
+	close();
+
+	_filename = filename;
+	_written = 0;
+	_preallocated = false;
+	_failed = false;
+#ifdef _WIN32
+	_fd = _open(filename.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+		    _S_IREAD | _S_IWRITE);
+#else
+	_fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+#endif
+	if (_fd == -1) {
+		cerr << "Failed to create output file '" << filename << "': "
+		     << strerror(errno) << endl;
+		return false;
+	}
+	setp(_buf, _buf + _buf_size);
+	return true;
+}
+
+void File_streambuf::preallocate(unsigned long long size)
+{
+	if (_fd == -1 || size == 0)
+		return;
+#ifdef __linux__
+	// KEEP_SIZE: reserve the blocks without changing the file size,
+	// close() trims whatever was over-estimated.
+	if (fallocate(_fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)size) == 0)
+		_preallocated = true;
+#endif
+}
+
+bool File_streambuf::write_all(const char* data, size_t size)
+{
+	while (size > 0) {
+#ifdef _WIN32
+		const int n = _write(_fd, data, (unsigned int)min(size, (size_t)1 << 30));
+#else
+		const ssize_t n = ::write(_fd, data, size);
+#endif
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		size -= n;
+		_written += n;
+	}
+	return true;
+}
+
+/* Write the buffered data followed by 'extra' (which can be NULL) */
+bool File_streambuf::write_buffered(const char* extra, size_t extra_size)
+{
+	const size_t buffered = pptr() - pbase();
+	setp(_buf, _buf + _buf_size);
+
+	if (_failed || _fd == -1)
+		return false;
+
+#ifdef _WIN32
+	_failed = !write_all(_buf, buffered) || !write_all(extra, extra_size);
+#else
+	struct iovec iov[2];
+	iov[0].iov_base = _buf;
+	iov[0].iov_len = buffered;
+	iov[1].iov_base = (void*)extra;
+	iov[1].iov_len = extra_size;
+
+	struct iovec* v = iov;
+	int cnt = 2;
+	while (cnt > 0) {
+		if (v->iov_len == 0) {
+			++v;
+			--cnt;
+			continue;
+		}
+		const ssize_t n = writev(_fd, v, cnt);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			_failed = true;
+			break;
+		}
+		_written += n;
+		// Partial write: skip what was written
+		size_t done = n;
+		while (cnt > 0 && done >= v->iov_len) {
+			done -= v->iov_len;
+			++v;
+			--cnt;
+		}
+		if (cnt > 0) {
+			v->iov_base = (char*)v->iov_base + done;
+			v->iov_len -= done;
+		}
+	}
+#endif
+	if (_failed)
+		cerr << "Failed to write output file '" << _filename << "': "
+		     << strerror(errno) << endl;
+	return !_failed;
+}
+
+File_streambuf::int_type File_streambuf::overflow(int_type ch)
+{
+	if (!write_buffered(NULL, 0))
+		return traits_type::eof();
+
+	if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(ch);
+		pbump(1);
+	}
+	return traits_type::not_eof(ch);
+}
+
+std::streamsize File_streambuf::xsputn(const char* s, std::streamsize n)
+{
+	if ((size_t)n >= DIRECT_WRITE_SIZE)
+		return write_buffered(s, n) ? n : 0;
+
+	std::streamsize left = n;
+	while (left > 0) {
+		if (pptr() == epptr() && !write_buffered(NULL, 0))
+			return n - left;
+		const std::streamsize room = min(left, (std::streamsize)(epptr() - pptr()));
+		memcpy(pptr(), s, room);
+		pbump((int)room);
+		s += room;
+		left -= room;
+	}
+	return n;
+}
+
+bool File_streambuf::close()
+{
+	if (_fd == -1)
+		return !_failed;
+
+	write_buffered(NULL, 0);
+
+#ifndef _WIN32
+	// Release the over-estimated part of the preallocated space
+	if (_preallocated && !_failed && ftruncate(_fd, (off_t)_written) != 0) {
+		cerr << "Failed to truncate output file '" << _filename << "': "
+		     << strerror(errno) << endl;
+		_failed = true;
+	}
+	const int rc = ::close(_fd);
+#else
+	const int rc = _close(_fd);
+#endif
+	if (rc != 0 && !_failed) {
+		cerr << "Failed to close output file '" << _filename << "': "
+		     << strerror(errno) << endl;
+		_failed = true;
+	}
+	_fd = -1;
+	return !_failed;
+}
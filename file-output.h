@@ -0,0 +1,65 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __FILE_OUTPUT__
+#define __FILE_OUTPUT__
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+
+/* A write-only stream buffer writing directly to a file descriptor,
+   in large chunks from a page-aligned buffer.
+
+   - sync() (e.g. std::endl) does not cause a write, only full chunks
+     (and close()) are written.
+   - Large writes (e.g. binary arrays) are passed to the kernel together
+     with the buffered data using writev(), without copying them.
+   - If the final size can be estimated, preallocate() reserves the disk
+     space up-front (Linux only), reducing fragmentation. */
+class File_streambuf : public std::streambuf {
+	char* _buf;
+	size_t _buf_size;
+	int _fd;
+	std::string _filename;
+	unsigned long long _written;
+	bool _preallocated;
+	bool _failed;
+
+	File_streambuf(const File_streambuf&);
+	File_streambuf& operator=(const File_streambuf&);
+
+	bool write_all(const char* data, size_t size);
+	bool write_buffered(const char* extra, size_t extra_size);
+
+protected:
+	virtual int_type overflow(int_type ch);
+	virtual std::streamsize xsputn(const char* s, std::streamsize n);
+
+public:
+	File_streambuf(size_t chunk_size = 4 << 20);
+	virtual ~File_streambuf();
+
+	/* Create/truncate the file. Returns false (and prints an error to STDERR)
+	   on failure. */
+	bool open(const std::string& filename);
+
+	/* Hint the expected final size of the file */
+	void preallocate(unsigned long long size);
+
+	/* Write the remaining data and close the file.
+	   Returns false (and prints an error to STDERR) if any write failed. */
+	bool close();
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <cstring>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <gp_Pnt.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+
+using namespace std;
+
+/* Points are merged only if they are bit-identical
+   (BRepMesh produces identical nodes on edges shared by two faces). */
+struct Point_key {
+	double x, y, z;
+
+	Point_key(const Point& p) :
+		// +0.0 turns -0.0 into 0.0
+		x(p.x() + 0.0), y(p.y() + 0.0), z(p.z() + 0.0) {};
+
+	bool operator==(const Point_key& o) const
+		{
+			return x==o.x && y==o.y && z==o.z;
+		}
+};
+
+struct Point_key_hash {
+	size_t operator()(const Point_key& k) const
+		{
+			uint64_t h[3];
+			memcpy(h, &k, sizeof(h));
+			uint64_t v = h[0] * 0x9E3779B97F4A7C15ULL;
+			v ^= h[1] + 0x7F4A7C159E3779B9ULL + (v << 6) + (v >> 2);
+			v ^= h[2] + 0x94D049BB133111EBULL + (v << 6) + (v >> 2);
+			return (size_t)(v ^ (v >> 31));
+		}
+};
+
+typedef unordered_map<Point_key, uint32_t, Point_key_hash> Point_map;
+
+static uint32_t add_vertex(Indexed_mesh& mesh, Point_map& map, const Point& p)
+{
+	auto ins = map.insert(make_pair(Point_key(p), (uint32_t)mesh.vertices.size()));
+	if (ins.second)
+		mesh.vertices.push_back(p);
+	return ins.first->second;
+}
+
+Indexed_mesh build_indexed_mesh(const Face_vector& faces, bool weld_faces)
+{
+	Indexed_mesh mesh;
+
+	size_t total = 0;
+	for (auto &f : faces)
+		total += f.size();
+
+	mesh.indices.reserve(total * 3);
+	mesh.faces.reserve(faces.size());
+	// A closed triangle mesh has about half as many vertices as triangles.
+	mesh.vertices.reserve(weld_faces ? total / 2 + 3 : total);
+
+	Point_map map;
+	map.reserve(weld_faces ? total / 2 + 3 : 0);
+
+	for (auto &f : faces) {
+		if (!weld_faces)
+			map.clear();
+
+		Mesh_face mf = { mesh.triangles(), f.size(), f.solid() };
+		for (size_t i=0;i<f.size();++i) {
+			const Triangle &t = f[i];
+			mesh.indices.push_back(add_vertex(mesh, map, t.p1()));
+			mesh.indices.push_back(add_vertex(mesh, map, t.p2()));
+			mesh.indices.push_back(add_vertex(mesh, map, t.p3()));
+		}
+		mesh.faces.push_back(mf);
+	}
+
+	return mesh;
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __INDEXED_MESH__
+#define __INDEXED_MESH__
+
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+/* The triangles of one STEP face: [first, first+count) in Indexed_mesh */
+struct Mesh_face {
+	size_t first;
+	size_t count;
+	size_t solid;     // see Face::solid()
+};
+
+/* A triangle mesh with shared vertices (unlike Face_vector, which is
+   a "triangle soup" with three separate points per triangle). */
+struct Indexed_mesh {
+	std::vector<Point> vertices;
+	std::vector<uint32_t> indices;    // three per triangle
+	std::vector<Mesh_face> faces;     // one per STEP face, in Face_vector order
+
+	size_t triangles() const { return indices.size() / 3; };
+};
+
+/* Build an indexed mesh by merging identical points.
+   With weld_faces=false, points are only merged within each face
+   (e.g. to keep sharp normals at the edges between faces). */
+Indexed_mesh build_indexed_mesh(const Face_vector& faces, bool weld_faces = true);
+
+#endif
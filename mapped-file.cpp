@@ -0,0 +1,149 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <iostream>
+#include <string>
+#include <cstring>
+#include <cerrno>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "mapped-file.h"
+
+#ifdef _WIN32
+
+Mapped_file::Mapped_file() :
+	_data(0), _size(0), _file(INVALID_HANDLE_VALUE), _mapping(0)
+{
+}
+
+bool Mapped_file::open(const std::string& filename)
+{
+	close();
+
+	_file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+			    OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_file == INVALID_HANDLE_VALUE) {
+		std::cerr << "Failed to open '" << filename << "'" << std::endl;
+		return false;
+	}
+
+	LARGE_INTEGER sz;
+	if (!GetFileSizeEx(_file, &sz)) {
+		std::cerr << "Failed to get size of '" << filename << "'" << std::endl;
+		close();
+		return false;
+	}
+	_size = (size_t)sz.QuadPart;
+
+	// Windows can't map empty files, but an empty file is a valid (empty) input.
+	if (_size == 0)
+		return true;
+
+	_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_mapping == NULL) {
+		std::cerr << "Failed to map '" << filename << "'" << std::endl;
+		close();
+		return false;
+	}
+
+	_data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+	if (_data == NULL) {
+		std::cerr << "Failed to map '" << filename << "'" << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void Mapped_file::close()
+{
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+	_data = 0;
+	_size = 0;
+	_mapping = 0;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+Mapped_file::Mapped_file() :
+	_data(0), _size(0), _fd(-1)
+{
+}
+
+bool Mapped_file::open(const std::string& filename)
+{
+	close();
+
+	_fd = ::open(filename.c_str(), O_RDONLY);
+	if (_fd == -1) {
+		std::cerr << "Failed to open '" << filename << "': "
+			  << strerror(errno) << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(_fd, &st) == -1) {
+		std::cerr << "Failed to stat '" << filename << "': "
+			  << strerror(errno) << std::endl;
+		close();
+		return false;
+	}
+	_size = (size_t)st.st_size;
+
+	if (_size == 0)
+		return true;
+
+	void* p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, _fd, 0);
+	if (p == MAP_FAILED) {
+		std::cerr << "Failed to map '" << filename << "': "
+			  << strerror(errno) << std::endl;
+		close();
+		return false;
+	}
+	// The STEP text is always scanned front to back.
+	madvise(p, _size, MADV_SEQUENTIAL);
+	_data = (const char*)p;
+	return true;
+}
+
+void Mapped_file::close()
+{
+	if (_data)
+		munmap((void*)_data, _size);
+	if (_fd != -1)
+		::close(_fd);
+	_data = 0;
+	_size = 0;
+	_fd = -1;
+}
+
+#endif
+
+Mapped_file::~Mapped_file()
+{
+	close();
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __MAPPED_FILE__
+#define __MAPPED_FILE__
+
+#include <cstddef>
+#include <string>
+
+/* A read-only memory mapping of an entire file.
+   Used to scan STEP text without copying it through iostreams. */
+class Mapped_file {
+	const char* _data;
+	size_t _size;
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#else
+	int _fd;
+#endif
+
+	Mapped_file(const Mapped_file&);
+	Mapped_file& operator=(const Mapped_file&);
+
+public:
+	Mapped_file();
+	~Mapped_file();
+
+	/* Returns false (and prints an error to STDERR) on failure */
+	bool open(const std::string& filename);
+	void close();
+
+	const char* data() const { return _data; };
+	size_t size() const { return _size; };
+};
+
+#endif
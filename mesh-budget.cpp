@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <cmath>
+#include <vector>
+
+#include <BRep_Tool.hxx>
+#include <BRepAdaptor_Surface.hxx>
+#include <BRepBndLib.hxx>
+#include <Bnd_Box.hxx>
+#include <GeomAbs_SurfaceType.hxx>
+#include <Poly_Triangulation.hxx>
+#include <TopExp_Explorer.hxx>
+#include <TopLoc_Location.hxx>
+#include <TopoDS.hxx>
+#include <TopoDS_Face.hxx>
+#include <TopoDS_Shape.hxx>
+
+#include "mesh-budget.h"
+
+using namespace std;
+
+double shape_diagonal(const TopoDS_Shape& shape)
+{
+	Bnd_Box box;
+	BRepBndLib::Add(shape, box);
+	if (box.IsVoid())
+		return 0;
+	return sqrt(box.SquareExtent());
+}
+
+static size_t face_triangles(const TopoDS_Face& face)
+{
+	TopLoc_Location loc;
+	Handle(Poly_Triangulation) tr = BRep_Tool::Triangulation(face, loc);
+	return tr.IsNull() ? 0 : tr->NbTriangles();
+}
+
+size_t count_triangles(const TopoDS_Shape& shape)
+{
+	size_t total = 0;
+	for (TopExp_Explorer ex(shape, TopAbs_FACE); ex.More(); ex.Next())
+		total += face_triangles(TopoDS::Face(ex.Current()));
+	return total;
+}
+
+static double surface_exponent(const TopoDS_Face& face)
+{
+	switch (BRepAdaptor_Surface(face, false).GetType()) {
+	case GeomAbs_Plane:
+		return 0;
+	case GeomAbs_Cylinder:
+	case GeomAbs_Cone:
+	case GeomAbs_SurfaceOfExtrusion:
+		return 0.5;
+	default:
+		return 1;
+	}
+}
+
+std::vector<Face_sample> sample_faces(const TopoDS_Shape& shape)
+{
+	vector<Face_sample> samples;
+	for (TopExp_Explorer ex(shape, TopAbs_FACE); ex.More(); ex.Next()) {
+		const TopoDS_Face& face = TopoDS::Face(ex.Current());
+		Face_sample s = { (double)face_triangles(face), surface_exponent(face) };
+		if (s.triangles > 0)
+			samples.push_back(s);
+	}
+	return samples;
+}
+
+static double predict_triangles(const std::vector<Face_sample>& samples, double ratio)
+{
+	double total = 0;
+	for (auto &s : samples)
+		total += s.triangles * pow(ratio, s.exponent);
+	return total;
+}
+
+double predict_tolerance(const std::vector<Face_sample>& samples,
+			 double tolerance, size_t triangles)
+{
+	// The prediction decreases with the tolerance: bisect on
+	// log(tolerance / new_tolerance), within a factor of 10^6 either way.
+	double lo = -6 * log(10.0), hi = 6 * log(10.0);
+	for (int i=0;i<60;++i) {
+		const double mid = (lo + hi) / 2;
+		if (predict_triangles(samples, exp(mid)) > triangles)
+			hi = mid;
+		else
+			lo = mid;
+	}
+	return tolerance / exp(lo);
+}
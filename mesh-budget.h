@@ -0,0 +1,45 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __MESH_BUDGET__
+#define __MESH_BUDGET__
+
+#include <cstddef>
+#include <vector>
+
+/* Diagonal of the bounding box of the shape (0 if it is empty) */
+double shape_diagonal(const TopoDS_Shape& shape);
+
+/* Number of triangles in the current triangulation of the shape */
+size_t count_triangles(const TopoDS_Shape& shape);
+
+/* How the triangles of one face scale with the linear tolerance:
+   about triangles * (tolerance / new_tolerance) ^ exponent */
+struct Face_sample {
+	double triangles;
+	double exponent;
+};
+
+/* Sample every face of the current triangulation. The exponent depends on
+   the surface type: 0 for planes (only their boundary matters), 0.5 for
+   surfaces curved in one direction (cylinders, cones, extrusions) and 1
+   for doubly-curved surfaces (the segment length grows with the square
+   root of the tolerance). */
+std::vector<Face_sample> sample_faces(const TopoDS_Shape& shape);
+
+/* The tolerance at which 'samples' (taken at 'tolerance') predict
+   'triangles' triangles */
+double predict_tolerance(const std::vector<Face_sample>& samples,
+			 double tolerance, size_t triangles);
+
+#endif
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+#include <gp_Pnt.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+#include "mesh-check.h"
+#include "parallel.h"
+
+using namespace std;
+
+struct Half_edge {
+	uint32_t from, to;
+	uint32_t face;
+};
+
+struct Edge_uses {
+	uint32_t forward;     // from the lower vertex index to the higher
+	uint32_t backward;
+
+	Edge_uses() : forward(0), backward(0) {};
+	bool bad() const { return forward != 1 || backward != 1; };
+};
+
+static uint64_t edge_key(const Half_edge& e)
+{
+	return (e.from < e.to) ? ((uint64_t)e.from << 32 | e.to) : ((uint64_t)e.to << 32 | e.from);
+}
+
+static size_t edge_shard(uint64_t key, size_t shards)
+{
+	key *= 0x9E3779B97F4A7C15ULL;
+	return (size_t)((key >> 32) % shards);
+}
+
+Mesh_check check_mesh(const Indexed_mesh& mesh, unsigned threads)
+{
+	const size_t triangles = mesh.triangles();
+	const size_t workers = max(1u, threads);
+	const size_t slices = min(workers, max((size_t)1, triangles));
+	const size_t shards = workers;
+
+	// Pass 1: half-edges of every slice of triangles, by shard
+	vector< vector< vector<Half_edge> > > half_edges(slices, vector< vector<Half_edge> >(shards));
+	vector<size_t> degenerate(slices, 0);
+	parallel_for(slices, (unsigned)workers, [&](size_t s) {
+		const size_t first = triangles * s / slices, last = triangles * (s + 1) / slices;
+
+		// The face of the first triangle of the slice
+		size_t face = 0;
+		while (face + 1 < mesh.faces.size() && mesh.faces[face].first + mesh.faces[face].count <= first)
+			++face;
+
+		vector< vector<Half_edge> > &out = half_edges[s];
+		for (auto &o : out)
+			o.reserve((last - first) * 3 / shards + 16);
+		for (size_t t=first;t<last;++t) {
+			while (face + 1 < mesh.faces.size() && mesh.faces[face].first + mesh.faces[face].count <= t)
+				++face;
+			const uint32_t* v = &mesh.indices[t * 3];
+			if (v[0] == v[1] || v[1] == v[2] || v[0] == v[2]) {
+				++degenerate[s];
+				continue;
+			}
+			for (int k=0;k<3;++k) {
+				Half_edge e = { v[k], v[(k+1)%3], (uint32_t)face };
+				out[edge_shard(edge_key(e), shards)].push_back(e);
+			}
+		}
+	});
+
+	// Pass 2: count the uses of every edge, shard by shard
+	vector<Mesh_check> results(shards);
+	parallel_for(shards, (unsigned)workers, [&](size_t sh) {
+		size_t total = 0;
+		for (size_t s=0;s<slices;++s)
+			total += half_edges[s][sh].size();
+
+		unordered_map<uint64_t, Edge_uses> uses;
+		uses.reserve(total / 2 + 1);
+		for (size_t s=0;s<slices;++s)
+			for (auto &e : half_edges[s][sh]) {
+				Edge_uses &u = uses[edge_key(e)];
+				if (e.from < e.to)
+					++u.forward;
+				else
+					++u.backward;
+			}
+
+		Mesh_check &r = results[sh];
+		r.edges = uses.size();
+		for (auto &u : uses) {
+			const uint32_t n = u.second.forward + u.second.backward;
+			if (n == 1)
+				++r.boundary_edges;
+			else if (n > 2)
+				++r.non_manifold_edges;
+			else if (u.second.bad())
+				++r.misoriented_edges;
+		}
+
+		if (!r.closed()) {
+			for (size_t s=0;s<slices;++s)
+				for (auto &e : half_edges[s][sh])
+					if (uses[edge_key(e)].bad())
+						r.bad_faces.push_back(e.face);
+			sort(r.bad_faces.begin(), r.bad_faces.end());
+			r.bad_faces.erase(unique(r.bad_faces.begin(), r.bad_faces.end()), r.bad_faces.end());
+		}
+	});
+
+	Mesh_check check;
+	check.triangles = triangles;
+	for (auto d : degenerate)
+		check.degenerate_triangles += d;
+	for (auto &r : results) {
+		check.edges += r.edges;
+		check.boundary_edges += r.boundary_edges;
+		check.non_manifold_edges += r.non_manifold_edges;
+		check.misoriented_edges += r.misoriented_edges;
+		check.bad_faces.insert(check.bad_faces.end(), r.bad_faces.begin(), r.bad_faces.end());
+	}
+	sort(check.bad_faces.begin(), check.bad_faces.end());
+	check.bad_faces.erase(unique(check.bad_faces.begin(), check.bad_faces.end()), check.bad_faces.end());
+	return check;
+}
+
+void write_mesh_check(const Mesh_check& check, std::ostream& ostrm)
+{
+	ostrm << "triangles: " << check.triangles << endl;
+	ostrm << "edges: " << check.edges << endl;
+	ostrm << "boundary_edges: " << check.boundary_edges << endl;
+	ostrm << "non_manifold_edges: " << check.non_manifold_edges << endl;
+	ostrm << "misoriented_edges: " << check.misoriented_edges << endl;
+	ostrm << "degenerate_triangles: " << check.degenerate_triangles << endl;
+	ostrm << "closed: " << (check.closed() ? "yes" : "no") << endl;
+	if (!check.bad_faces.empty()) {
+		ostrm << "bad_faces:";
+		for (auto f : check.bad_faces)
+			ostrm << " " << (f + 1);
+		ostrm << endl;
+	}
+}
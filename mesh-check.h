@@ -0,0 +1,51 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __MESH_CHECK__
+#define __MESH_CHECK__
+
+#include <cstddef>
+#include <ostream>
+#include <vector>
+
+/* Result of check_mesh(). Every edge of a closed, oriented 2-manifold
+   is used by exactly two triangles, once in each direction. */
+struct Mesh_check {
+	size_t triangles;
+	size_t edges;
+	size_t boundary_edges;        // used by one triangle (a hole)
+	size_t non_manifold_edges;    // used by more than two triangles
+	size_t misoriented_edges;     // used twice in the same direction
+	size_t degenerate_triangles;  // with a repeated vertex (not checked)
+	std::vector<size_t> bad_faces;  // STEP faces (0-based) of the bad edges
+
+	Mesh_check() : triangles(0), edges(0), boundary_edges(0), non_manifold_edges(0),
+		       misoriented_edges(0), degenerate_triangles(0) {};
+
+	bool closed() const
+		{
+			return boundary_edges == 0 && non_manifold_edges == 0
+				&& misoriented_edges == 0;
+		}
+};
+
+/* Count the uses of every edge in a hash map of half-edges, in linear
+   time: the half-edges are collected from slices of the triangles and
+   sharded by edge, on up to 'threads' threads. */
+Mesh_check check_mesh(const Indexed_mesh& mesh, unsigned threads = 1);
+
+/* Print the result as "key: value" lines (bad faces are 1-based,
+   like the face_N names of the outputs) */
+void write_mesh_check(const Mesh_check& check, std::ostream& ostrm);
+
+#endif
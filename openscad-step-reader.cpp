@@ -12,22 +12,44 @@
  * GNU Lesser General Public License for more details.
  */
 #include <iostream>
+#include <iomanip>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <cstdlib>
 #include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#ifdef _WIN32
 #include <Windows.h>
+#include <io.h>
+#include <fcntl.h>
+#endif
 
  // OpenCASCADE headers
-#include <STEPControl_Reader.hxx>
+#include <Standard_Version.hxx>
 #include <StlAPI_Writer.hxx>
-#include <BRepMesh_IncrementalMesh.hxx>
+#include <TopoDS_Shape.hxx>
 
 // Project headers
 #include "triangle.h"
-#include "tessellation.h"
+#include "indexed-mesh.h"
+#include "step-reader.h"
 #include "openscad-triangle-writer.h"
-#include "explore-shape.h"
+#include "step-info.h"
+#include "compressed-input.h"
+#include "compressed-output.h"
+#include "file-output.h"
+#include "sidecar-output.h"
+#include "shm-output.h"
+#include "quantize.h"
+#include "decimate.h"
+#include "mesh-check.h"
+#include "parallel.h"
+
+/* --clean: edges shorter than this fraction of the linear tolerance are collapsed */
+#define CLEAN_EDGE_FRACTION 0.001
 
 // Windows-compatible command-line parsing
 struct Option {
@@ -44,7 +66,14 @@ enum OutputFormat {
     OUT_STL_SCAD,
     OUT_STL_FACES,
     OUT_STL_OCCT,
-    OUT_EXPLORE
+    OUT_OBJ,
+    OUT_PLY,
+    OUT_3MF,
+    OUT_GLB,
+    OUT_SHM,
+    OUT_CHECK,
+    OUT_EXPLORE,
+    OUT_INFO
 };
 
 static Option options[] = {
@@ -55,7 +84,31 @@ static Option options[] = {
     {"stl-faces", 0, 0, 'f'},
     {"stl-occt",  0, 0, 'o'},
     {"stl-lin-tol", 1, 0, 'L'},
+    {"lod",       1, 0, 'l'},
+    {"max-triangles", 1, 0, 'T'},
+    {"rel-tol",   1, 0, 'R'},
+    {"decimate",  1, 0, 'd'},
+    {"max-error", 1, 0, 'E'},
+    {"keep-face-edges", 0, 0, 'K'},
+    {"clean",     0, 0, 'C'},
+    {"check",     0, 0, 'k'},
+    {"split-solids", 0, 0, 'X'},
+    {"obj",       0, 0, 'w'},
+    {"ply",       0, 0, 'y'},
+    {"3mf",       0, 0, '3'},
+    {"glb",       0, 0, 'g'},
+    {"shm",       0, 0, 'm'},
     {"explore",   0, 0, 'e'},
+    {"info",      0, 0, 'i'},
+    {"pre-parse", 0, 0, 'p'},
+    {"threads",   1, 0, 'j'},
+    {"compress",  1, 0, 'z'},
+    {"output",    1, 0, 'O'},
+    {"sidecar",   0, 0, 'S'},
+    {"compact-faces", 0, 0, 'c'},
+    {"precision", 1, 0, 'P'},
+    {"decimals",  1, 0, 'D'},
+    {"quantize",  1, 0, 'Q'},
     {0, 0, 0, 0}
 };
 
@@ -67,7 +120,8 @@ void show_help()
         "\n"
         "usage: openscad-step-reader [options] INPUT.STEP\n"
         "\n"
-        "Output is written to STDOUT.\n"
+        "INPUT.STEP can be gzip or zstd compressed (e.g. 'part.stp.gz').\n"
+        "Output is written to STDOUT, unless --output is used.\n"
         "\n"
         "options are:\n"
         "   -h, --help         this help screen\n"
@@ -91,11 +145,146 @@ void show_help()
         "                      'face' information from the STEP file. Each face will be rendered\n"
         "                      in a different color in openscad $preview mode.\n"
         "\n"
+        "   -w, --obj          convert the input STEP file into a Wavefront OBJ file,\n"
+        "                      with shared vertices and a group ('g face_N') per\n"
+        "                      STEP face.\n"
+        "\n"
+        "   -y, --ply          convert the input STEP file into a binary PLY file,\n"
+        "                      with shared vertices and a 'face' property holding\n"
+        "                      the STEP face number of each triangle.\n"
+        "\n"
+        "   -3, --3mf          convert the input STEP file into a 3MF file, with a\n"
+        "                      separate object for every solid, and the triangles\n"
+        "                      of each STEP face colored like with --stl-faces.\n"
+        "                      (3MF files are already zip-compressed).\n"
+        "\n"
+        "   -g, --glb          convert the input STEP file into a binary glTF file\n"
+        "                      (for web viewers), with a node for every solid and a\n"
+        "                      primitive (with vertex normals and the --stl-faces\n"
+        "                      color) for every STEP face.\n"
+        "\n"
+        "   -m, --shm          write the mesh (shared vertices, indices and the\n"
+        "                      triangles of every STEP face) into a new POSIX\n"
+        "                      shared memory segment, and print only its name.\n"
+        "                      The consumer maps it (see stepreader_shm_header in\n"
+        "                      step-reader-c.h) and removes it with shm_unlink().\n"
+        "\n"
+        "   -c, --compact-faces\n"
+        "                      with --stl-scad/--stl-faces: generate the 'faces'\n"
+        "                      vectors with a list comprehension\n"
+        "                      ([for (i=[0:N-1]) [3*i,3*i+1,3*i+2]]) instead of\n"
+        "                      listing every triangle. Smaller, faster to parse.\n"
+        "\n"
+        "   -P, --precision N  print coordinates with N significant digits\n"
+        "                      (default: 6) in the text outputs (--stl-ascii,\n"
+        "                      --stl-scad, --stl-faces, --obj and --3mf).\n"
+        "\n"
+        "   -D, --decimals N   print coordinates with (at most) N decimals in the\n"
+        "                      text outputs, e.g. '-D 3' for micron resolution in\n"
+        "                      millimeter models. Like --precision, not for the\n"
+        "                      binary --ply and --glb outputs.\n"
+        "\n"
+        "   -Q, --quantize B   snap all points to a grid of 2^B steps along the\n"
+        "                      longest side of the bounding box. Nearly identical\n"
+        "                      points become identical (closing cracks between faces),\n"
+        "                      and the text outputs use just enough decimals for\n"
+        "                      the grid (unless --precision/--decimals are given).\n"
+        "\n"
+        "   -T, --max-triangles N\n"
+        "                      choose the linear tolerance which gives about N\n"
+        "                      (normally not more) triangles, instead of using a\n"
+        "                      fixed one. Takes two to four meshing passes: the\n"
+        "                      first, coarse one is used to predict the tolerance\n"
+        "                      from the surface types of the faces.\n"
+        "\n"
+        "   -R, --rel-tol F    use a linear tolerance of F times the diagonal of\n"
+        "                      the bounding box, e.g. '-R 0.001' meshes a 2mm screw\n"
+        "                      and a 2m frame with the same relative accuracy.\n"
+        "\n"
+        "   -C, --clean        remove degenerate triangles from the tessellation:\n"
+        "                      edges shorter than 1/1000 of the linear tolerance\n"
+        "                      are collapsed (the edges between STEP faces only\n"
+        "                      along the edge), and the longest edge of thinner\n"
+        "                      triangles is flipped. The mesh stays watertight.\n"
+        "                      The counts are printed to STDERR.\n"
+        "\n"
+        "   -k, --check        check that the mesh is closed (watertight, every\n"
+        "                      edge shared by exactly two triangles, consistently\n"
+        "                      oriented). Alone, prints a report (with the STEP\n"
+        "                      faces of the bad edges) and exits with status 1 if\n"
+        "                      the mesh is not closed. With an output format, a\n"
+        "                      mesh which is not closed is rejected before writing.\n"
+        "\n"
+        "   -d, --decimate R   simplify the mesh to about R (0 to 1) of its\n"
+        "                      triangles, e.g. for previews and collision meshes:\n"
+        "                      edges are collapsed by the least change of the\n"
+        "                      surface (quadric error). Watertight meshes stay\n"
+        "                      watertight.\n"
+        "\n"
+        "   -E, --max-error E  simplify the mesh as long as the surface moves by\n"
+        "                      less than about E (in model units). With --decimate,\n"
+        "                      stops at whichever limit comes first.\n"
+        "\n"
+        "   -K, --keep-face-edges\n"
+        "                      with --decimate/--max-error: keep the edges between\n"
+        "                      STEP faces (they are only simplified along the edges,\n"
+        "                      the corners are kept).\n"
+        "\n"
+        "   -l, --lod T1,T2..  load and transfer the STEP file once and write a\n"
+        "                      level of detail for every linear tolerance (from\n"
+        "                      the coarsest, every level is meshed anew) to its\n"
+        "                      own file, e.g. '--lod 1,0.1 -O part.scad' writes\n"
+        "                      'part-lod0.scad' and 'part-lod1.scad'. With\n"
+        "                      --stl-scad/--stl-faces, 'part.scad' includes the\n"
+        "                      coarsest level in $preview mode and the finest\n"
+        "                      when rendering (override with 'openscad -D lod=N').\n"
+        "\n"
+        "   -X, --split-solids convert every solid of the STEP file into its own\n"
+        "                      file (e.g. '-X -O asm.scad' writes 'asm-solid0.scad',\n"
+        "                      'asm-solid1.scad'...), meshing and writing the\n"
+        "                      solids in parallel. Faces which are not part of\n"
+        "                      a solid go into the last file. With --stl-scad/\n"
+        "                      --stl-faces, 'asm.scad' includes all of them\n"
+        "                      (hide one with 'openscad -D solid_N=false').\n"
+        "\n"
         "   -e, --explore      Work-in-progress code, used for development and exploration\n"
         "                      of OpenCASCADE class hierarchy, e.g.\n"
         "                      Shell->Face->Surface->Wire->Edge->Vertex.\n"
         "                      produces debug messges and no useful output.\n"
         "\n"
+        "   -i, --info         print statistics of the STEP file (schema, entity\n"
+        "                      counts by type, number of faces/B-Spline surfaces/\n"
+        "                      products) using a quick text scan, without\n"
+        "                      loading it with OpenCASCADE.\n"
+        "\n"
+        "   -p, --pre-parse    validate the STEP text (record syntax, duplicated\n"
+        "                      and dangling '#N' references) with a fast parallel\n"
+        "                      scan before loading it with OpenCASCADE. Malformed\n"
+        "                      files are rejected with their line numbers.\n"
+        "                      (The scan adds to the loading time, it does not\n"
+        "                      speed up the OpenCASCADE reader.)\n"
+        "\n"
+        "   -j, --threads N    use N threads (default: all available cores) for\n"
+        "                      --pre-parse/--info scanning and for formatting the\n"
+        "                      text output (the output is identical for any N).\n"
+        "\n"
+        "   -z, --compress FMT compress the output on the fly, FMT is 'gzip' or 'zstd'.\n"
+        "                      Compression runs on a separate thread. Can be used\n"
+        "                      with --stl-ascii, --stl-scad, --stl-faces, --obj,\n"
+        "                      --ply and --glb.\n"
+        "\n"
+        "   -O, --output FILE  write the output to FILE instead of STDOUT. The file\n"
+        "                      is written in large chunks (and its space preallocated\n"
+        "                      when the size can be estimated), which is much faster\n"
+        "                      than piping large outputs through STDOUT.\n"
+        "\n"
+        "   -S, --sidecar      with --stl-scad/--stl-faces: write the mesh into\n"
+        "                      binary STL files next to the --output file, and only\n"
+        "                      SCAD code which import()s them (OpenSCAD imports STL\n"
+        "                      much faster than it parses large vectors).\n"
+        "                      --stl-faces adds an STL file per color for $preview,\n"
+        "                      e.g. 'part.scad' imports 'part.stl', 'part-red.stl'...\n"
+        "\n"
         "Written by Assaf Gordon (assafgordon@gmail.com)\n"
         "License: LGPLv2.1 or later\n"
         "\n";
@@ -108,11 +297,180 @@ void show_version()
     exit(0);
 }
 
-// Simple Windows-compatible command line parser
-OutputFormat parse_command_line(int argc, char* argv[], const Option* options, std::string& filename, double& stl_lin_tol) {
-    OutputFormat output = OUT_UNDEFINED;
-    stl_lin_tol = 0.5; // default linear tolerance
+/* Output formats written by our code from the tessellated faces */
+bool uses_faces(OutputFormat output)
+{
+    return output == OUT_STL_ASCII || output == OUT_STL_SCAD || output == OUT_STL_FACES
+        || output == OUT_OBJ || output == OUT_PLY || output == OUT_3MF
+        || output == OUT_GLB || output == OUT_SHM || output == OUT_CHECK;
+}
+
+// Settings collected from the command line
+struct Settings {
+    OutputFormat output;
+    std::string filename;
+    double stl_lin_tol;
+    std::vector<double> lods;  // --lod tolerances, coarsest first
+    unsigned long max_triangles;  // triangle budget, 0 = none
+    double rel_tol;        // tolerance relative to the bounding box diagonal, 0 = none
+    double decimate;       // fraction of the triangles to keep, 0 = no limit
+    double max_error;      // decimation error bound, 0 = no limit
+    bool keep_face_edges;
+    bool clean;
+    bool check;            // reject meshes which are not closed
+    bool split_solids;     // convert every solid into its own file
+    unsigned threads;      // 0 = use all available cores
+    bool pre_parse;
+    Compression compression;
+    std::string output_file;   // empty = STDOUT
+    bool sidecar;
+    bool compact_faces;
+    int precision;         // significant digits, -1 = default
+    int decimals;          // fixed decimals, -1 = not fixed
+    unsigned quantize;     // grid bits, 0 = no quantization
+
+    Settings() : output(OUT_UNDEFINED), stl_lin_tol(0.5), max_triangles(0), rel_tol(0),
+                 decimate(0), max_error(0), keep_face_edges(false), clean(false),
+                 check(false), split_solids(false), threads(0), pre_parse(false),
+                 compression(COMPRESSION_NONE), sidecar(false),
+                 compact_faces(false), precision(-1), decimals(-1), quantize(0) {}
+};
+
+// Apply a single option (with its argument, for options which take one)
+void handle_option(const Option& option, const char* optarg, Settings& settings)
+{
+    switch (option.val) {
+    case 'h': show_help(); break;
+    case 'V': show_version(); break;
+    case 'a': settings.output = OUT_STL_ASCII; break;
+    case 's': settings.output = OUT_STL_SCAD; break;
+    case 'f': settings.output = OUT_STL_FACES; break;
+    case 'o': settings.output = OUT_STL_OCCT; break;
+    case 'w': settings.output = OUT_OBJ; break;
+    case 'y': settings.output = OUT_PLY; break;
+    case '3': settings.output = OUT_3MF; break;
+    case 'g': settings.output = OUT_GLB; break;
+    case 'm': settings.output = OUT_SHM; break;
+    case 'e': settings.output = OUT_EXPLORE; break;
+    case 'i': settings.output = OUT_INFO; break;
+    case 'p': settings.pre_parse = true; break;
+    case 'S': settings.sidecar = true; break;
+    case 'c': settings.compact_faces = true; break;
+    case 'K': settings.keep_face_edges = true; break;
+    case 'C': settings.clean = true; break;
+    case 'k': settings.check = true; break;
+    case 'X': settings.split_solids = true; break;
+
+    case 'L':
+        settings.stl_lin_tol = atof(optarg);
+        if (settings.stl_lin_tol <= 0) {
+            std::cerr << "Invalid tolerance value '" << optarg << "'" << std::endl;
+            exit(1);
+        }
+        break;
+
+    case 'l':
+    {
+        std::istringstream list(optarg);
+        std::string value;
+        while (std::getline(list, value, ',')) {
+            const double tol = atof(value.c_str());
+            if (tol <= 0) {
+                std::cerr << "Invalid tolerance value '" << value << "' in --lod" << std::endl;
+                exit(1);
+            }
+            settings.lods.push_back(tol);
+        }
+        std::sort(settings.lods.begin(), settings.lods.end(), std::greater<double>());
+        settings.lods.erase(std::unique(settings.lods.begin(), settings.lods.end()),
+                            settings.lods.end());
+        break;
+    }
+
+    case 'T':
+        settings.max_triangles = strtoul(optarg, NULL, 10);
+        if (settings.max_triangles == 0) {
+            std::cerr << "Invalid number of triangles '" << optarg << "'" << std::endl;
+            exit(1);
+        }
+        break;
+
+    case 'R':
+        settings.rel_tol = atof(optarg);
+        if (settings.rel_tol <= 0 || settings.rel_tol >= 1) {
+            std::cerr << "Invalid relative tolerance '" << optarg << "' (between 0 and 1)" << std::endl;
+            exit(1);
+        }
+        break;
+
+    case 'd':
+        settings.decimate = atof(optarg);
+        if (settings.decimate <= 0 || settings.decimate >= 1) {
+            std::cerr << "Invalid decimation ratio '" << optarg << "' (between 0 and 1)" << std::endl;
+            exit(1);
+        }
+        break;
+
+    case 'E':
+        settings.max_error = atof(optarg);
+        if (settings.max_error <= 0) {
+            std::cerr << "Invalid maximum error '" << optarg << "'" << std::endl;
+            exit(1);
+        }
+        break;
 
+    case 'j':
+        if (atoi(optarg) <= 0) {
+            std::cerr << "Invalid number of threads '" << optarg << "'" << std::endl;
+            exit(1);
+        }
+        settings.threads = atoi(optarg);
+        break;
+
+    case 'O':
+        settings.output_file = optarg;
+        break;
+
+    case 'P':
+        settings.precision = atoi(optarg);
+        if (settings.precision < 1 || settings.precision > 17) {
+            std::cerr << "Invalid precision '" << optarg << "' (1 to 17 digits)" << std::endl;
+            exit(1);
+        }
+        break;
+
+    case 'D':
+        settings.decimals = atoi(optarg);
+        if (optarg[0] < '0' || optarg[0] > '9' || settings.decimals > 17) {
+            std::cerr << "Invalid number of decimals '" << optarg << "' (0 to 17)" << std::endl;
+            exit(1);
+        }
+        break;
+
+    case 'Q':
+        if (atoi(optarg) < 1 || atoi(optarg) > 40) {
+            std::cerr << "Invalid quantization bits '" << optarg << "' (1 to 40)" << std::endl;
+            exit(1);
+        }
+        settings.quantize = atoi(optarg);
+        break;
+
+    case 'z':
+        settings.compression = parse_compression_name(optarg);
+        if (settings.compression == COMPRESSION_NONE) {
+            std::cerr << "Invalid compression format '" << optarg << "'" << std::endl;
+            exit(1);
+        }
+        if (!compression_supported(settings.compression)) {
+            std::cerr << "Compression format '" << optarg << "' is not supported by this build" << std::endl;
+            exit(1);
+        }
+        break;
+    }
+}
+
+// Simple Windows-compatible command line parser
+void parse_command_line(int argc, char* argv[], const Option* options, Settings& settings) {
     // Skip program name
     int argIndex = 1;
 
@@ -121,175 +479,528 @@ OutputFormat parse_command_line(int argc, char* argv[], const Option* options, s
 
         // Check if it's an option (starts with - or --)
         if (arg[0] == '-') {
-            // Long option
-            if (arg[1] == '-') {
-                std::string option_name = arg.substr(2);
-                bool found = false;
-
-                for (int i = 0; options[i].name != 0; i++) {
-                    if (option_name == options[i].name) {
-                        found = true;
-
-                        // Handle option with argument
-                        if (options[i].has_arg && argIndex + 1 < argc) {
-                            if (options[i].val == 'L') {
-                                stl_lin_tol = atof(argv[argIndex + 1]);
-                                if (stl_lin_tol <= 0) {
-                                    std::cerr << "Invalid tolerance value '" << argv[argIndex + 1] << "'" << std::endl;
-                                    exit(1);
-                                }
-                                argIndex++;
-                            }
-                        }
-
-                        // Handle option based on its value
-                        switch (options[i].val) {
-                        case 'h': show_help(); break;
-                        case 'V': show_version(); break;
-                        case 'a': output = OUT_STL_ASCII; break;
-                        case 's': output = OUT_STL_SCAD; break;
-                        case 'f': output = OUT_STL_FACES; break;
-                        case 'o': output = OUT_STL_OCCT; break;
-                        case 'e': output = OUT_EXPLORE; break;
-                        }
-                        break;
-                    }
-                }
+            const Option* found = 0;
+
+            for (int i = 0; options[i].name != 0; i++) {
+                // Long option
+                if (arg[1] == '-' && arg.substr(2) == options[i].name)
+                    found = &options[i];
+                // Short option
+                else if (arg[1] != '-' && arg[1] == options[i].val)
+                    found = &options[i];
+
+                if (found)
+                    break;
+            }
 
-                if (!found) {
-                    std::cerr << "Unknown option: " << arg << std::endl;
-                    exit(1);
-                }
+            if (!found) {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                exit(1);
             }
-            // Short option
-            else {
-                char option_char = arg[1];
-                bool found = false;
-
-                for (int i = 0; options[i].name != 0; i++) {
-                    if (option_char == options[i].val) {
-                        found = true;
-
-                        // Handle option with argument
-                        if (options[i].has_arg && argIndex + 1 < argc) {
-                            if (options[i].val == 'L') {
-                                stl_lin_tol = atof(argv[argIndex + 1]);
-                                if (stl_lin_tol <= 0) {
-                                    std::cerr << "Invalid tolerance value '" << argv[argIndex + 1] << "'" << std::endl;
-                                    exit(1);
-                                }
-                                argIndex++;
-                            }
-                        }
-
-                        // Handle option based on its value
-                        switch (options[i].val) {
-                        case 'h': show_help(); break;
-                        case 'V': show_version(); break;
-                        case 'a': output = OUT_STL_ASCII; break;
-                        case 's': output = OUT_STL_SCAD; break;
-                        case 'f': output = OUT_STL_FACES; break;
-                        case 'o': output = OUT_STL_OCCT; break;
-                        case 'e': output = OUT_EXPLORE; break;
-                        }
-                        break;
-                    }
-                }
 
-                if (!found) {
-                    std::cerr << "Unknown option: " << arg << std::endl;
+            // Handle option with argument
+            const char* optarg = 0;
+            if (found->has_arg) {
+                if (argIndex + 1 >= argc) {
+                    std::cerr << "Missing argument for option: " << arg << std::endl;
                     exit(1);
                 }
+                optarg = argv[++argIndex];
             }
+
+            handle_option(*found, optarg, settings);
         }
         else {
             // Not an option - should be the filename
-            filename = arg;
+            settings.filename = arg;
         }
 
         argIndex++;
     }
 
-    if (filename.empty()) {
+    if (settings.filename.empty()) {
         std::cerr << "Missing input STEP filename. Use --help for usage information" << std::endl;
         exit(1);
     }
 
-    if (output == OUT_UNDEFINED) {
+    /* --check alone only prints the report */
+    if (settings.output == OUT_UNDEFINED && settings.check)
+        settings.output = OUT_CHECK;
+
+    if (settings.output == OUT_UNDEFINED) {
         std::cerr << "Missing output format option. Use --help for usage information" << std::endl;
         exit(1);
     }
 
-    // Return the selected output format
-    return output;
-}
+    if (settings.compression != COMPRESSION_NONE
+        && (!uses_faces(settings.output) || settings.output == OUT_3MF
+            || settings.output == OUT_SHM || settings.output == OUT_CHECK)) {
+        std::cerr << "--compress can only be used with --stl-ascii, --stl-scad, --stl-faces, --obj, --ply or --glb" << std::endl;
+        exit(1);
+    }
 
-int main(int argc, char* argv[])
-{
-    // Setup console for UTF-8 output
-    SetConsoleOutputCP(CP_UTF8);
+    if (!settings.output_file.empty() && settings.output == OUT_EXPLORE) {
+        std::cerr << "--output can not be used with --explore" << std::endl;
+        exit(1);
+    }
 
-    std::string filename;
-    double stl_lin_tol;
+    if (settings.compact_faces && settings.output != OUT_STL_SCAD && settings.output != OUT_STL_FACES) {
+        std::cerr << "--compact-faces can only be used with --stl-scad or --stl-faces" << std::endl;
+        exit(1);
+    }
 
-    OutputFormat output = parse_command_line(argc, argv, options, filename, stl_lin_tol);
+    /* The binary outputs have no printed coordinates */
+    if ((settings.precision >= 0 || settings.decimals >= 0)
+        && (!uses_faces(settings.output) || settings.output == OUT_PLY || settings.output == OUT_GLB
+            || settings.output == OUT_SHM || settings.output == OUT_CHECK)) {
+        std::cerr << "--precision and --decimals can only be used with --stl-ascii,"
+                     " --stl-scad, --stl-faces, --obj or --3mf" << std::endl;
+        exit(1);
+    }
 
-    /* Load the shape from STEP file.
-       See https://github.com/miho/OCC-CSG/blob/master/src/occ-csg.cpp#L311
-       and https://github.com/lvk88/OccTutorial/blob/master/OtherExamples/runners/convertStepToStl.cpp
-     */
-    TopoDS_Shape shape;
+    if (settings.quantize && !uses_faces(settings.output)) {
+        std::cerr << "--quantize can only be used with --stl-ascii, --stl-scad, --stl-faces,"
+                     " --obj, --ply, --3mf, --glb or --shm" << std::endl;
+        exit(1);
+    }
 
-    STEPControl_Reader Reader;
-    IFSelect_ReturnStatus s = Reader.ReadFile(filename.c_str());
-    if (s != IFSelect_RetDone) {
-        std::cerr << "Failed to load STEP file '" << filename << "'" << std::endl;
-        return 1;
+    if (settings.precision >= 0 && settings.decimals >= 0) {
+        std::cerr << "--precision and --decimals can not be used together" << std::endl;
+        exit(1);
+    }
+
+    const bool decimate = settings.decimate > 0 || settings.max_error > 0;
+    if (decimate && !uses_faces(settings.output)) {
+        std::cerr << "--decimate and --max-error can only be used with --stl-ascii, --stl-scad,"
+                     " --stl-faces, --obj, --ply, --3mf, --glb or --shm" << std::endl;
+        exit(1);
+    }
+
+    if (settings.clean && !uses_faces(settings.output)) {
+        std::cerr << "--clean can only be used with --stl-ascii, --stl-scad, --stl-faces,"
+                     " --obj, --ply, --3mf, --glb or --shm" << std::endl;
+        exit(1);
+    }
+
+    if (settings.check && !uses_faces(settings.output)) {
+        std::cerr << "--check can only be used with --stl-ascii, --stl-scad, --stl-faces,"
+                     " --obj, --ply, --3mf, --glb or --shm" << std::endl;
+        exit(1);
+    }
+
+    if (settings.keep_face_edges && !decimate) {
+        std::cerr << "--keep-face-edges requires --decimate or --max-error" << std::endl;
+        exit(1);
     }
-    Reader.TransferRoots();
-    shape = Reader.OneShape();
 
-    /* Is this required (for Tessellation and/or StlAPI_Writer?) */
-    BRepMesh_IncrementalMesh mesh(shape, stl_lin_tol);
-    mesh.Perform();
+    if (settings.max_triangles && settings.rel_tol > 0) {
+        std::cerr << "--max-triangles and --rel-tol can not be used together" << std::endl;
+        exit(1);
+    }
+
+    if ((settings.max_triangles || settings.rel_tol > 0) && !settings.lods.empty()) {
+        std::cerr << "--max-triangles and --rel-tol can not be used with --lod" << std::endl;
+        exit(1);
+    }
+
+    if (!settings.lods.empty()) {
+        if (!uses_faces(settings.output) || settings.output == OUT_SHM
+            || settings.output == OUT_CHECK) {
+            std::cerr << "--lod can only be used with --stl-ascii, --stl-scad, --stl-faces,"
+                         " --obj, --ply, --3mf or --glb" << std::endl;
+            exit(1);
+        }
+        if (settings.output_file.empty()) {
+            std::cerr << "--lod requires --output FILE (the file names of the levels are based on it)" << std::endl;
+            exit(1);
+        }
+        if (settings.compression != COMPRESSION_NONE) {
+            std::cerr << "--lod can not be used with --compress" << std::endl;
+            exit(1);
+        }
+    }
+
+    if (settings.split_solids) {
+        if (!uses_faces(settings.output) || settings.output == OUT_SHM
+            || settings.output == OUT_CHECK) {
+            std::cerr << "--split-solids can only be used with --stl-ascii, --stl-scad, --stl-faces,"
+                         " --obj, --ply, --3mf or --glb" << std::endl;
+            exit(1);
+        }
+        if (settings.output_file.empty()) {
+            std::cerr << "--split-solids requires --output FILE (the file names of the solids are based on it)" << std::endl;
+            exit(1);
+        }
+        if (settings.compression != COMPRESSION_NONE) {
+            std::cerr << "--split-solids can not be used with --compress" << std::endl;
+            exit(1);
+        }
+        if (!settings.lods.empty() || settings.max_triangles) {
+            std::cerr << "--split-solids can not be used with --lod or --max-triangles" << std::endl;
+            exit(1);
+        }
+    }
+
+    if (settings.sidecar) {
+        if (settings.output != OUT_STL_SCAD && settings.output != OUT_STL_FACES) {
+            std::cerr << "--sidecar can only be used with --stl-scad or --stl-faces" << std::endl;
+            exit(1);
+        }
+        if (settings.output_file.empty()) {
+            std::cerr << "--sidecar requires --output FILE (the STL file names are based on it)" << std::endl;
+            exit(1);
+        }
+        if (settings.compression != COMPRESSION_NONE) {
+            std::cerr << "--sidecar can not be used with --compress" << std::endl;
+            exit(1);
+        }
+    }
+}
+
+/* Rough size of the text output, used to preallocate the output file */
+unsigned long long estimate_output_size(OutputFormat output, unsigned long long triangles)
+{
+    switch (output)
+    {
+    case OUT_STL_ASCII:
+        return triangles * 200;
+    case OUT_STL_SCAD:
+    case OUT_STL_FACES:
+        return triangles * 120;
+    case OUT_OBJ:
+        return triangles * 45;
+    case OUT_PLY:
+        return triangles * 23;
+    case OUT_3MF:
+        return triangles * 20;
+    case OUT_GLB:
+        return triangles * 32;
+    default:
+        return 0;
+    }
+}
+
+/* Tessellate the meshed shape and write it in the selected format to 'out',
+   which writes to 'output_file' (the file 'output_filename'), or to STDOUT
+   if it is NULL. Returns false (after printing an error to STDERR) on failure. */
+bool write_output(Step_reader& reader, const Settings& settings,
+                  const std::string& output_filename, std::ostream& out,
+                  File_streambuf* output_file)
+{
+    const OutputFormat output = settings.output;
+    const TopoDS_Shape& shape = reader.shape();
+
+    /* The formats with shared vertices take the mesh straight from the
+       triangulation, where adjacent faces share the nodes of their common
+       edges (exact and watertight, see tessellate_shape_indexed) - unless
+       the triangles are changed first. */
+    const bool decimate = settings.decimate > 0 || settings.max_error > 0;
+    const bool indexed = output == OUT_OBJ || output == OUT_PLY || output == OUT_3MF
+        || output == OUT_SHM || output == OUT_CHECK;
+    const bool edge_mesh = indexed && !settings.clean && !decimate && !settings.quantize;
 
     Face_vector faces;
+    Indexed_mesh mesh;
 
-    if ((output == OUT_STL_ASCII) || (output == OUT_STL_SCAD) || (output == OUT_STL_FACES))
-        faces = tessellate_shape(shape);
+    if (edge_mesh) {
+        mesh = reader.indexed_mesh();
+    }
+    else if (uses_faces(output)) {
+        Cleanup_stats cleanup;
+        faces = reader.faces(settings.clean ? reader.tolerance() * CLEAN_EDGE_FRACTION : 0,
+                             &cleanup);
+        if (settings.clean)
+            std::cerr << "Cleanup: collapsed " << cleanup.short_edges << " short edges (dropping "
+                      << cleanup.degenerate << " degenerate triangles), flipped "
+                      << cleanup.flipped << " edges of thin triangles" << std::endl;
+    }
+
+    Writer_options writer_opts;
+    writer_opts.threads = settings.threads ? settings.threads : hardware_threads();
+    writer_opts.compact_faces = settings.compact_faces;
+
+    if (decimate) {
+        Decimate_options decimate_opts;
+        decimate_opts.ratio = settings.decimate;
+        decimate_opts.max_error = settings.max_error;
+        decimate_opts.keep_face_edges = settings.keep_face_edges;
+        decimate_opts.threads = writer_opts.threads;
+        decimate_faces(faces, decimate_opts);
+    }
+
+    /* Coordinates in the text outputs: quantized to a grid, and printed
+       with fixed decimals or a number of significant digits */
+    int decimals = settings.decimals;
+    if (settings.quantize) {
+        const double step = quantize_faces(faces, settings.quantize, writer_opts.threads);
+        if (decimals < 0 && settings.precision < 0)
+            decimals = grid_decimals(step);
+    }
+    if (indexed && !edge_mesh)
+        mesh = build_indexed_mesh(faces);
+
+    /* --check: the final mesh (after decimation and quantization, which can
+       both break it) must be closed. Checked before the (slow) writers. */
+    if (output == OUT_CHECK || settings.check) {
+        const Mesh_check check = check_mesh(indexed ? mesh : build_indexed_mesh(faces),
+                                            writer_opts.threads);
+        if (output == OUT_CHECK) {
+            write_mesh_check(check, out);
+            return check.closed();
+        }
+        if (!check.closed()) {
+            std::cerr << "Mesh check failed, the mesh is not closed:" << std::endl;
+            write_mesh_check(check, std::cerr);
+            return false;
+        }
+    }
+
+    if (decimals >= 0)
+        out << std::fixed << std::setprecision(decimals);
+    else if (settings.precision > 0)
+        out.precision(settings.precision);
+
+#ifdef _WIN32
+    if (!output_file && (settings.compression != COMPRESSION_NONE || output == OUT_PLY
+                         || output == OUT_3MF || output == OUT_GLB))
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    /* Optionally compress the output (on a separate thread) */
+    std::unique_ptr<Compressing_streambuf> compressor;
+    if (settings.compression != COMPRESSION_NONE) {
+        compressor.reset(new Compressing_streambuf(out.rdbuf(), settings.compression));
+        out.rdbuf(compressor.get());
+    }
+    else if (output_file && !settings.sidecar) {
+        unsigned long long triangles = mesh.triangles();
+        for (auto &f : faces)
+            triangles += f.size();
+        output_file->preallocate(estimate_output_size(output, triangles));
+    }
 
     switch (output)
     {
     case OUT_STL_ASCII:
-        write_triangles_ascii_stl(faces);
+        write_triangles_ascii_stl(faces, out, writer_opts);
         break;
 
     case OUT_STL_SCAD:
-        write_triangle_scad(faces);
+    case OUT_STL_FACES:
+        if (settings.sidecar) {
+            if (!write_scad_sidecars(faces, output_filename, output == OUT_STL_FACES, out))
+                return false;
+        }
+        else if (output == OUT_STL_SCAD)
+            write_triangle_scad(faces, out, writer_opts);
+        else
+            write_faces_scad(faces, out, writer_opts);
         break;
 
-    case OUT_STL_FACES:
-        write_faces_scad(faces);
+    case OUT_OBJ:
+        write_obj(mesh, out, writer_opts);
+        break;
+
+    case OUT_PLY:
+        write_ply(mesh, out);
         break;
 
+    case OUT_3MF:
+        if (!write_3mf(mesh, out, writer_opts))
+            return false;
+        break;
+
+    case OUT_GLB:
+        // Not welded: every face keeps its own vertices and normals
+        if (!write_glb(build_indexed_mesh(faces, false), out, writer_opts))
+            return false;
+        break;
+
+    case OUT_SHM:
+    {
+        std::string name;
+        if (!write_shm_mesh(mesh, name))
+            return false;
+        out << name << std::endl;
+        break;
+    }
+
     case OUT_STL_OCCT:
         try
         {
             StlAPI_Writer writer;
-            // Use standard output for Windows
-            writer.Write(shape, "stdout");
+            std::string path = settings.output_file;
+            if (path.empty()) {
+#ifdef _WIN32
+                // Use standard output for Windows
+                path = "stdout";
+#else
+                path = "/dev/stdout";
+#endif
+            }
+            std::cout.flush();
+            if (!writer.Write(shape, path.c_str())) {
+                std::cerr << "Failed to write OCCT/STL to '" << path << "'" << std::endl;
+                return false;
+            }
         }
         catch (Standard_ConstructionError& e)
         {
             std::cerr << "Failed to write OCCT/STL: " << e.GetMessageString() << std::endl;
-            return 1;
+            return false;
         }
         break;
 
     case OUT_EXPLORE:
-        explore_shape(shape);
+        reader.explore();
         break;
     }
 
+    if (compressor && !compressor->finish()) {
+        std::cerr << "Failed to write compressed output" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+/* Output file number 'n' of a kind, e.g. with --lod ('part.scad', "lod", 0)
+   -> 'part-lod0.scad' */
+std::string numbered_filename(const std::string& filename, const char* kind, size_t n)
+{
+    const size_t slash = filename.find_last_of("/\\");
+    size_t dot = filename.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = filename.size();
+
+    std::ostringstream name;
+    name << filename.substr(0, dot) << "-" << kind << n << filename.substr(dot);
+    return name.str();
+}
+
+/* --lod: mesh the shape, loaded and transferred only once, with every
+   tolerance (coarsest first, which is level 0), and write every level into
+   its own file. For SCAD outputs, 'out' (the --output file) gets the code
+   which picks the level by $preview. */
+bool write_lods(Step_reader& reader, const Settings& settings, std::ostream& out)
+{
+    std::vector<std::string> files;
+    for (size_t i=0;i<settings.lods.size();++i) {
+        const std::string filename = numbered_filename(settings.output_file, "lod", i);
+        File_streambuf file;
+        if (!file.open(filename))
+            return false;
+        std::ostream lod_out(&file);
+
+        reader.mesh(settings.lods[i]);
+        if (!write_output(reader, settings, filename, lod_out, &file) || !file.close())
+            return false;
+        files.push_back(filename);
+    }
+
+    if (settings.output == OUT_STL_SCAD || settings.output == OUT_STL_FACES)
+        write_scad_lod_index(files, settings.lods, out);
+    return true;
+}
+
+/* --split-solids: mesh, tessellate and write every solid into its own file,
+   the solids in parallel (each on a single thread). For SCAD outputs, 'out'
+   (the --output file) gets the code which includes all of them. */
+bool write_solids(const Step_reader& reader, const Settings& settings,
+                  double linear_tolerance, std::ostream& out)
+{
+    const unsigned threads = settings.threads ? settings.threads : hardware_threads();
+    std::vector<Step_reader> parts = reader.split_solids();
+    mesh_parts(parts, linear_tolerance, threads);
+
+    Settings part_settings = settings;
+    part_settings.threads = 1;
+
+    std::vector<std::string> files(parts.size());
+    std::vector<char> ok(parts.size(), 0);
+    parallel_for(parts.size(), threads, [&](size_t i) {
+        files[i] = numbered_filename(settings.output_file, "solid", i);
+        File_streambuf file;
+        if (!file.open(files[i]))
+            return;
+        std::ostream part_out(&file);
+        ok[i] = write_output(parts[i], part_settings, files[i], part_out, &file) && file.close();
+    });
+    if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+        return false;
+
+    if (settings.output == OUT_STL_SCAD || settings.output == OUT_STL_FACES)
+        write_scad_solid_index(files, out);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+#ifdef _WIN32
+    // Setup console for UTF-8 output
+    SetConsoleOutputCP(CP_UTF8);
+#endif
+
+    Settings settings;
+    parse_command_line(argc, argv, options, settings);
+
+    const std::string& filename = settings.filename;
+    const OutputFormat output = settings.output;
+
+    /* Create the output file first, to fail before a long conversion.
+       (OpenCASCADE's STL writer opens the file by itself, and with --lod
+       or --split-solids only the SCAD outputs write the --output file itself) */
+    const bool lod_files_only = (!settings.lods.empty() || settings.split_solids)
+        && output != OUT_STL_SCAD && output != OUT_STL_FACES;
+    std::unique_ptr<File_streambuf> output_file;
+    std::streambuf* sink = std::cout.rdbuf();
+    if (!settings.output_file.empty() && output != OUT_STL_OCCT && !lod_files_only) {
+        output_file.reset(new File_streambuf());
+        if (!output_file->open(settings.output_file))
+            return 1;
+        sink = output_file.get();
+    }
+    std::ostream out(sink);
+
+    /* --info only scans the STEP text, no need to load the shape */
+    if (output == OUT_INFO) {
+        if (!print_step_info(filename, settings.threads, out))
+            return 1;
+        return (!output_file || output_file->close()) ? 0 : 1;
+    }
+
+    Step_reader_options reader_opts;
+    reader_opts.threads = settings.threads;
+    reader_opts.pre_parse = settings.pre_parse;
+
+    Step_reader reader(reader_opts);
+    if (!reader.load(filename))
+        return 1;
+
+    if (!settings.lods.empty()) {
+        if (!write_lods(reader, settings, out))
+            return 1;
+    }
+    else if (settings.split_solids) {
+        const double tolerance = settings.rel_tol > 0 ? settings.rel_tol * reader.diagonal()
+                                                      : settings.stl_lin_tol;
+        if (!write_solids(reader, settings, tolerance, out))
+            return 1;
+    }
+    else {
+        /* Is this required (for Tessellation and/or StlAPI_Writer?) */
+        if (settings.max_triangles)
+            reader.mesh_to_budget(settings.max_triangles);
+        else if (settings.rel_tol > 0)
+            reader.mesh(settings.rel_tol * reader.diagonal());
+        else
+            reader.mesh(settings.stl_lin_tol);
+        if (!write_output(reader, settings, settings.output_file, out, output_file.get()))
+            return 1;
+    }
+
+    if (output_file && !output_file->close())
+        return 1;
+
     return 0;
 }
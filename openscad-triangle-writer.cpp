@@ -11,50 +11,150 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
  * GNU Lesser General Public License for more details.
  */
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <ostream>
 #include <iostream>
+#include <sstream>
+#include <stdint.h>
 #include <vector>
 
 #include <gp_Pnt.hxx>
 
 #include "triangle.h"
+#include "indexed-mesh.h"
+#include "openscad-triangle-writer.h"
+#include "parallel.h"
+#include "zip-writer.h"
 
 using namespace std;
 
 
+/* Output is formatted in pieces of about this many triangles,
+   on multiple threads (see write_ordered_parallel) */
+#define PIECE_TRIANGLES 4096
+
+enum Row_kind {
+	ROWS_STL,
+	ROWS_POINTS,
+	ROWS_FACES
+};
+
+/* Output rows of triangles [first,last) of one face */
+struct Rows {
+	size_t face;
+	Row_kind kind;
+	size_t first, last;
+};
+typedef vector<Rows> Piece;
+
+/* Append the rows of 'count' triangles to the pieces, starting a new
+   piece every PIECE_TRIANGLES triangles. Empty faces still get (empty)
+   rows, so their headers are written. */
+static void add_rows(vector<Piece>& pieces, size_t& fill,
+		     size_t face, Row_kind kind, size_t count)
+{
+	size_t first = 0;
+	do {
+		if (pieces.empty() || fill >= PIECE_TRIANGLES) {
+			pieces.push_back(Piece());
+			fill = 0;
+		}
+		const size_t n = min(count - first, (size_t)PIECE_TRIANGLES - fill);
+		Rows r = { face, kind, first, first + n };
+		pieces.back().push_back(r);
+		fill += n;
+		first += n;
+	} while (first < count);
+}
+
+static void write_rows(std::ostream& ostrm, const Face& f, const Rows& r)
+{
+	switch (r.kind)
+	{
+	case ROWS_STL:
+		f.write_ascii_stl(ostrm, r.first, r.last);
+		break;
+	case ROWS_POINTS:
+		f.write_points_rows(ostrm, r.first, r.last);
+		break;
+	case ROWS_FACES:
+		f.write_face_rows(ostrm, r.first, r.last);
+		break;
+	}
+}
+
+
 /* Write the faces/triangles as an ASCII stl file
    (with invalud 'normals' value - but these are ignored anyhow in OpenSCAD */
-void write_triangles_ascii_stl(const Face_vector& faces)
+void write_triangles_ascii_stl(const Face_vector& faces, std::ostream& ostrm,
+			       const Writer_options& opts)
 {
-	cout << "solid" << endl;
-	for (auto &f : faces)
-		f.write_ascii_stl(cout);
-	cout << "endsolid" << endl;
+	vector<Piece> pieces;
+	size_t fill = 0;
+	for (size_t i=0;i<faces.size();++i)
+		add_rows(pieces, fill, i, ROWS_STL, faces[i].size());
+
+	ostrm << "solid" << endl;
+	write_ordered_parallel(ostrm, pieces.size(), opts.threads,
+		[&](std::ostream& o, size_t p) {
+			for (auto &r : pieces[p])
+				write_rows(o, faces[r.face], r);
+		});
+	ostrm << "endsolid" << endl;
 }
 
 /* Write the faces/triangles as two vectors (one "POINTS", one "FACES")
    that will be used with a single call to "polyhedron"). */
-void write_triangle_scad(const Face_vector& faces)
+void write_triangle_scad(const Face_vector& faces, std::ostream& ostrm,
+			 const Writer_options& opts)
 {
 	Face all;
+	if (!faces.empty())
+		all.set_origin(faces[0].origin());
 
 	// Merge all faces (i.e. triangles from all faces)
 	// into one "face" (just a container, no special meaning of a "face").
 	for (auto &f : faces)
 		all.add_face(f);
 
+	vector<Piece> points, indices;
+	size_t fill = 0;
+	add_rows(points, fill, 0, ROWS_POINTS, all.size());
+	fill = 0;
+	if (!opts.compact_faces)
+		add_rows(indices, fill, 0, ROWS_FACES, all.size());
+
+	auto write_piece = [&](const vector<Piece>& pieces) {
+		return [&](std::ostream& o, size_t p) {
+			for (auto &r : pieces[p])
+				write_rows(o, all, r);
+		};
+	};
+
 	// Write vector of points and faces
-	cout << "points = " ;
-	all.write_points_vector(cout);
-	cout << "faces = ";
-	all.write_face_vector(cout);
+	ostrm << "points = " ;
+	ostrm << "[" << endl;
+	write_ordered_parallel(ostrm, points.size(), opts.threads, write_piece(points));
+	ostrm << "];" << endl;
+	ostrm << "faces = ";
+	if (opts.compact_faces) {
+		all.write_compact_face_vector(ostrm);
+	} else {
+		ostrm << "[" << endl;
+		write_ordered_parallel(ostrm, indices.size(), opts.threads, write_piece(indices));
+		ostrm << "];" << endl;
+	}
 
 	// Call Polyhedron
-	cout << "module solid_object() {" << endl;
-	cout << "  polyhedron (points,faces);"<< endl;
-	cout << "}" << endl;
-	cout << endl;
-	cout << "solid_object();" << endl;
+	ostrm << "module solid_object() {" << endl;
+	ostrm << "  polyhedron (points,faces);"<< endl;
+	ostrm << "}" << endl;
+	ostrm << endl;
+	ostrm << "solid_object();" << endl;
 }
 
 
@@ -76,6 +176,33 @@ const char* colors[NUM_COLORS] = {
 	"SpringGreen"
 };
 
+/* The same colors as RGB values, for formats without color names */
+const char* colors_rgb[NUM_COLORS] = {
+	"#000000",
+	"#EE82EE",
+	"#FF0000",
+	"#0000FF",
+	"#7CFC00",
+	"#FFA500",
+	"#FF1493",
+	"#FFD700",
+	"#00FFFF",
+	"#808000",
+	"#808080",
+	"#00FF7F"
+};
+
+/* Color index of face number 'face' (0-based), as in write_faces_scad */
+static size_t face_color(size_t face)
+{
+	return (face + 1) % NUM_COLORS;
+}
+
+const char* face_color_name(size_t face)
+{
+	return colors[face_color(face)];
+}
+
 
 /* Write every faces (i.e. all trianges of each face) into a separate points/faces
    vector pairs.
@@ -86,45 +213,609 @@ const char* colors[NUM_COLORS] = {
 
    In non-preview mode,
    Include code to merge all the vectors and make a single "Polyhedron" call. */
-void write_faces_scad (const Face_vector& faces)
+void write_faces_scad (const Face_vector& faces, std::ostream& ostrm,
+		       const Writer_options& opts)
 {
-	int i = 1;
-	for (auto &f : faces) {
-		cout << "face_" << i << "_points = " ;
-		f.write_points_vector(cout);
-		cout << "face_" << i << "_faces = " ;
-		f.write_face_vector(cout);
-		cout << endl ;
-		++i;
+	int i;
+
+	vector<Piece> pieces;
+	size_t fill = 0;
+	for (size_t f=0;f<faces.size();++f) {
+		add_rows(pieces, fill, f, ROWS_POINTS, faces[f].size());
+		if (!opts.compact_faces)
+			add_rows(pieces, fill, f, ROWS_FACES, faces[f].size());
 	}
 
+	write_ordered_parallel(ostrm, pieces.size(), opts.threads,
+		[&](std::ostream& o, size_t p) {
+			for (auto &r : pieces[p]) {
+				const Face &f = faces[r.face];
+				const char* name = (r.kind == ROWS_POINTS) ? "_points" : "_faces";
+				if (r.first == 0)
+					o << "face_" << (r.face+1) << name << " = " << "[" << endl;
+				write_rows(o, f, r);
+				if (r.last == f.size()) {
+					o << "];" << endl;
+					if (r.kind == ROWS_POINTS && opts.compact_faces) {
+						o << "face_" << (r.face+1) << "_faces = ";
+						f.write_compact_face_vector(o);
+					}
+					if (r.kind == ROWS_FACES || opts.compact_faces)
+						o << endl ;
+				}
+			}
+		});
+
 	/* crazy colors version, draw each face by itself */
-	cout << "module crazy_colors() {" << endl;
+	ostrm << "module crazy_colors() {" << endl;
 	for (i=1;i<=faces.size();++i) {
 		const char* color = colors[i%NUM_COLORS] ;
-		cout << "color(\"" << color << "\")" << endl;
-		cout << "polyhedron(face_" << i <<"_points, face_" << i << "_faces);" << endl ;
+		ostrm << "color(\"" << color << "\")" << endl;
+		ostrm << "polyhedron(face_" << i <<"_points, face_" << i << "_faces);" << endl ;
 	}
-	cout << "}" << endl;
+	ostrm << "}" << endl;
 
-	cout << "function add_offset(vec,ofs) = [for (x=vec) x + [ofs,ofs,ofs]];" << endl;
-	cout << "module solid_object() {" << endl;
-	cout << "  tmp1_points = face_1_points;" << endl;
-	cout << "  tmp1_faces =  face_1_faces;" << endl;
-	cout << endl;
+	ostrm << "function add_offset(vec,ofs) = [for (x=vec) x + [ofs,ofs,ofs]];" << endl;
+	ostrm << "module solid_object() {" << endl;
+	ostrm << "  tmp1_points = face_1_points;" << endl;
+	ostrm << "  tmp1_faces =  face_1_faces;" << endl;
+	ostrm << endl;
 	for (i=2;i<=faces.size();++i) {
-		cout << "  tmp"<<i<<"_points = concat(tmp"<<(i-1)<<"_points, face_"<<i<<"_points);" << endl;
-		cout << "  tmp"<<i<<"_faces =  concat(tmp"<<(i-1)<<"_faces,add_offset(face_"<<i<<"_faces,len(tmp"<<(i-1)<<"_points)));" << endl;
-		cout << endl;
-	}
-	cout << "  polyhedron (tmp"<<(faces.size())<<"_points, tmp"<<(faces.size())<<"_faces);"<< endl;
-	cout << "}" << endl;
-	cout << endl;
-	cout << endl;
-
-	cout << "if ($preview) {;" << endl;
-	cout << "  crazy_colors();" << endl;
-	cout << "} else {" << endl;
-	cout << "  solid_object();" << endl;
-	cout << "}" << endl;
+		ostrm << "  tmp"<<i<<"_points = concat(tmp"<<(i-1)<<"_points, face_"<<i<<"_points);" << endl;
+		ostrm << "  tmp"<<i<<"_faces =  concat(tmp"<<(i-1)<<"_faces,add_offset(face_"<<i<<"_faces,len(tmp"<<(i-1)<<"_points)));" << endl;
+		ostrm << endl;
+	}
+	ostrm << "  polyhedron (tmp"<<(faces.size())<<"_points, tmp"<<(faces.size())<<"_faces);"<< endl;
+	ostrm << "}" << endl;
+	ostrm << endl;
+	ostrm << endl;
+
+	ostrm << "if ($preview) {;" << endl;
+	ostrm << "  crazy_colors();" << endl;
+	ostrm << "} else {" << endl;
+	ostrm << "  solid_object();" << endl;
+	ostrm << "}" << endl;
+}
+
+
+/* Write the indexed mesh as a Wavefront OBJ file.
+   Each STEP face becomes a group ("g face_N"). */
+void write_obj(const Indexed_mesh& mesh, std::ostream& ostrm,
+	       const Writer_options& opts)
+{
+	ostrm << "# openscad-step-reader" << "\n";
+	ostrm << "# " << mesh.vertices.size() << " vertices, "
+	      << mesh.triangles() << " triangles, "
+	      << mesh.faces.size() << " faces" << "\n";
+
+	const size_t nv = mesh.vertices.size();
+	write_ordered_parallel(ostrm, (nv + PIECE_TRIANGLES - 1) / PIECE_TRIANGLES, opts.threads,
+		[&](std::ostream& o, size_t p) {
+			const size_t last = min(nv, (p+1) * PIECE_TRIANGLES);
+			for (size_t i=p*PIECE_TRIANGLES;i<last;++i) {
+				const Point &v = mesh.vertices[i];
+				o << "v ";
+				write_coord(o, v.x());
+				o << " ";
+				write_coord(o, v.y());
+				o << " ";
+				write_coord(o, v.z());
+				o << "\n";
+			}
+		});
+
+	vector<Piece> pieces;
+	size_t fill = 0;
+	for (size_t f=0;f<mesh.faces.size();++f)
+		add_rows(pieces, fill, f, ROWS_FACES, mesh.faces[f].count);
+
+	write_ordered_parallel(ostrm, pieces.size(), opts.threads,
+		[&](std::ostream& o, size_t p) {
+			for (auto &r : pieces[p]) {
+				if (r.first == 0)
+					o << "g face_" << (r.face+1) << "\n";
+				const size_t base = mesh.faces[r.face].first;
+				for (size_t t=base+r.first;t<base+r.last;++t) {
+					// OBJ indices are 1-based
+					o << "f " << (mesh.indices[t*3]+1)
+					  << " " << (mesh.indices[t*3+1]+1)
+					  << " " << (mesh.indices[t*3+2]+1) << "\n";
+				}
+			}
+		});
+}
+
+
+static bool host_is_little_endian()
+{
+	const uint16_t one = 1;
+	return *(const uint8_t*)&one == 1;
+}
+
+/* Collects binary data, writing it to the stream in large blocks */
+class Binary_writer {
+	std::ostream& _ostrm;
+	vector<char> _buf;
+	size_t _used;
+
+public:
+	Binary_writer(std::ostream& ostrm, size_t block_size = 1 << 20) :
+		_ostrm(ostrm), _buf(block_size), _used(0) {};
+	~Binary_writer() { flush(); };
+
+	template<class T>
+	void put(const T& value)
+		{
+			if (_used + sizeof(T) > _buf.size())
+				flush();
+			memcpy(&_buf[_used], &value, sizeof(T));
+			_used += sizeof(T);
+		}
+
+	/* Little-endian, whatever the host's byte order */
+	template<class T>
+	void put_le(T value)
+		{
+			if (!host_is_little_endian()) {
+				char* p = (char*)&value;
+				std::reverse(p, p + sizeof(T));
+			}
+			put(value);
+		}
+
+	void flush()
+		{
+			_ostrm.write(&_buf[0], _used);
+			_used = 0;
+		}
+};
+
+/* Write the indexed mesh as a binary PLY file, in the host's byte order.
+   Each triangle has a 'face' property with its (1-based) STEP face number. */
+void write_ply(const Indexed_mesh& mesh, std::ostream& ostrm)
+{
+	ostrm << "ply" << "\n";
+	ostrm << "format " << (host_is_little_endian() ? "binary_little_endian" : "binary_big_endian")
+	      << " 1.0" << "\n";
+	ostrm << "comment openscad-step-reader" << "\n";
+	ostrm << "element vertex " << mesh.vertices.size() << "\n";
+	ostrm << "property float x" << "\n";
+	ostrm << "property float y" << "\n";
+	ostrm << "property float z" << "\n";
+	ostrm << "element face " << mesh.triangles() << "\n";
+	ostrm << "property list uchar int vertex_indices" << "\n";
+	ostrm << "property int face" << "\n";
+	ostrm << "end_header" << "\n";
+
+	Binary_writer out(ostrm);
+	for (auto &v : mesh.vertices) {
+		out.put((float)v.x());
+		out.put((float)v.y());
+		out.put((float)v.z());
+	}
+
+	for (size_t f=0;f<mesh.faces.size();++f) {
+		const Mesh_face &mf = mesh.faces[f];
+		for (size_t t=mf.first;t<mf.first+mf.count;++t) {
+			out.put((uint8_t)3);
+			out.put((int32_t)mesh.indices[t*3]);
+			out.put((int32_t)mesh.indices[t*3+1]);
+			out.put((int32_t)mesh.indices[t*3+2]);
+			out.put((int32_t)(f+1));
+		}
+	}
+}
+
+
+/* Write the indexed mesh as a 3MF package (a zip file with an XML model).
+   Every solid becomes a separate object, and every triangle gets the color
+   of its STEP face (the same colors as write_faces_scad).
+   The XML is compressed and written while it is formatted. */
+bool write_3mf(const Indexed_mesh& mesh, std::ostream& ostrm,
+	       const Writer_options& opts)
+{
+	Zip_writer zip(ostrm.rdbuf());
+
+	zip.add_file("[Content_Types].xml",
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">\n"
+		" <Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>\n"
+		" <Default Extension=\"model\" ContentType=\"application/vnd.ms-package.3dmanufacturing-3dmodel+xml\"/>\n"
+		"</Types>\n");
+	zip.add_file("_rels/.rels",
+		"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		"<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">\n"
+		" <Relationship Target=\"/3D/3dmodel.model\" Id=\"rel0\" "
+		"Type=\"http://schemas.microsoft.com/3dmanufacturing/2013/01/3dmodel\"/>\n"
+		"</Relationships>\n");
+
+	// The faces of every (non-empty) solid
+	vector< vector<size_t> > solids;
+	for (size_t f=0;f<mesh.faces.size();++f) {
+		if (mesh.faces[f].count == 0)
+			continue;
+		if (mesh.faces[f].solid >= solids.size())
+			solids.resize(mesh.faces[f].solid + 1);
+		solids[mesh.faces[f].solid].push_back(f);
+	}
+
+	/* Generous estimate of the XML size, to choose zip64 up front: the digits
+	   of a coordinate follow --precision/--decimals (with std::fixed, the
+	   integer digits of the largest coordinate come on top), plus 8 for the
+	   sign, point, exponent and quotes. A vertex line has ~30 more bytes,
+	   a triangle line at most ~80 (three 10-digit indices). */
+	unsigned long long digits = ostrm.precision();
+	if (ostrm.flags() & std::ios_base::fixed) {
+		double largest = 1;
+		for (auto &v : mesh.vertices)
+			largest = max(largest, max(fabs(v.x()), max(fabs(v.y()), fabs(v.z()))));
+		digits += (unsigned long long)log10(largest) + 1;
+	}
+	const unsigned long long xml_size =
+		mesh.vertices.size() * (30 + 3 * (digits + 8)) + mesh.triangles() * 80ULL;
+	std::ostream model(zip.begin_entry("3D/3dmodel.model", xml_size >= 0xFFFFFFFFULL));
+	model.copyfmt(ostrm);   // --precision/--decimals
+
+	model << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" << "\n";
+	model << "<model unit=\"millimeter\" xml:lang=\"en-US\" "
+	      << "xmlns=\"http://schemas.microsoft.com/3dmanufacturing/core/2015/02\">" << "\n";
+	model << " <resources>" << "\n";
+	model << "  <basematerials id=\"1\">" << "\n";
+	for (size_t i=0;i<NUM_COLORS;++i)
+		model << "   <base name=\"" << colors[i] << "\" displaycolor=\"" << colors_rgb[i] << "\"/>" << "\n";
+	model << "  </basematerials>" << "\n";
+
+	// Per-object vertex numbers (objects don't share vertices in 3MF)
+	const uint32_t NO_VERTEX = 0xFFFFFFFF;
+	vector<uint32_t> local(mesh.vertices.size(), NO_VERTEX);
+	vector<uint32_t> used;
+
+	vector<size_t> object_ids;
+	for (auto &faces : solids) {
+		if (faces.empty())
+			continue;
+		const size_t id = object_ids.size() + 2;
+		object_ids.push_back(id);
+
+		used.clear();
+		for (auto f : faces) {
+			const Mesh_face &mf = mesh.faces[f];
+			for (size_t i=mf.first*3;i<(mf.first+mf.count)*3;++i) {
+				const uint32_t v = mesh.indices[i];
+				if (local[v] == NO_VERTEX) {
+					local[v] = (uint32_t)used.size();
+					used.push_back(v);
+				}
+			}
+		}
+
+		model << "  <object id=\"" << id << "\" type=\"model\" pid=\"1\" pindex=\""
+		      << face_color(faces[0]) << "\">" << "\n";
+		model << "   <mesh>" << "\n";
+		model << "    <vertices>" << "\n";
+		write_ordered_parallel(model, (used.size() + PIECE_TRIANGLES - 1) / PIECE_TRIANGLES, opts.threads,
+			[&](std::ostream& o, size_t p) {
+				const size_t last = min(used.size(), (p+1) * PIECE_TRIANGLES);
+				for (size_t i=p*PIECE_TRIANGLES;i<last;++i) {
+					const Point &v = mesh.vertices[used[i]];
+					o << "     <vertex x=\"";
+					write_coord(o, v.x());
+					o << "\" y=\"";
+					write_coord(o, v.y());
+					o << "\" z=\"";
+					write_coord(o, v.z());
+					o << "\"/>" << "\n";
+				}
+			});
+		model << "    </vertices>" << "\n";
+		model << "    <triangles>" << "\n";
+
+		vector<Piece> pieces;
+		size_t fill = 0;
+		for (auto f : faces)
+			add_rows(pieces, fill, f, ROWS_FACES, mesh.faces[f].count);
+		write_ordered_parallel(model, pieces.size(), opts.threads,
+			[&](std::ostream& o, size_t p) {
+				for (auto &r : pieces[p]) {
+					const size_t base = mesh.faces[r.face].first;
+					for (size_t t=base+r.first;t<base+r.last;++t) {
+						o << "     <triangle v1=\"" << local[mesh.indices[t*3]]
+						  << "\" v2=\"" << local[mesh.indices[t*3+1]]
+						  << "\" v3=\"" << local[mesh.indices[t*3+2]]
+						  << "\" p1=\"" << face_color(r.face) << "\"/>" << "\n";
+					}
+				}
+			});
+		model << "    </triangles>" << "\n";
+		model << "   </mesh>" << "\n";
+		model << "  </object>" << "\n";
+
+		for (auto v : used)
+			local[v] = NO_VERTEX;
+	}
+	model << " </resources>" << "\n";
+
+	model << " <build>" << "\n";
+	for (auto id : object_ids)
+		model << "  <item objectid=\"" << id << "\"/>" << "\n";
+	model << " </build>" << "\n";
+	model << "</model>" << "\n";
+
+	zip.end_entry();
+	return zip.finish();
+}
+
+
+/* Write the triangles of the selected faces as a binary STL file */
+void write_binary_stl(const Face_vector& faces, const std::vector<size_t>& selection,
+		      std::ostream& ostrm)
+{
+	size_t count = 0;
+	for (auto f : selection)
+		count += faces[f].size();
+
+	Binary_writer out(ostrm);
+
+	// The header must not start with "solid" (that's an ASCII STL)
+	char header[80] = "openscad-step-reader";
+	for (size_t i=0;i<sizeof(header);++i)
+		out.put(header[i]);
+	out.put_le((uint32_t)count);
+
+	for (auto f : selection) {
+		const Face &face = faces[f];
+		for (size_t i=0;i<face.size();++i) {
+			const Triangle &t = face[i];
+			const Point &a = t.p1(), &b = t.p2(), &c = t.p3();
+			const double ux = b.x()-a.x(), uy = b.y()-a.y(), uz = b.z()-a.z();
+			const double vx = c.x()-a.x(), vy = c.y()-a.y(), vz = c.z()-a.z();
+			double nx = uy*vz - uz*vy, ny = uz*vx - ux*vz, nz = ux*vy - uy*vx;
+			const double len = sqrt(nx*nx + ny*ny + nz*nz);
+			if (len > 0) {
+				nx /= len;
+				ny /= len;
+				nz /= len;
+			}
+			out.put_le((float)nx);
+			out.put_le((float)ny);
+			out.put_le((float)nz);
+			for (const Point* p : { &a, &b, &c }) {
+				out.put_le((float)p->x());
+				out.put_le((float)p->y());
+				out.put_le((float)p->z());
+			}
+			out.put_le((uint16_t)0);
+		}
+	}
+}
+
+void write_binary_stl(const Face_vector& faces, std::ostream& ostrm)
+{
+	std::vector<size_t> all(faces.size());
+	for (size_t i=0;i<all.size();++i)
+		all[i] = i;
+	write_binary_stl(faces, all, ostrm);
+}
+
+
+/* One glTF primitive: the triangles of one (non-empty) STEP face */
+struct Glb_primitive {
+	size_t face;
+	uint32_t first_vertex;
+	uint32_t vertices;
+	float min[3];
+	float max[3];
+};
+
+/* glTF colors are linear, convert from the sRGB "#RRGGBB" values */
+static double srgb_to_linear(const char* hex)
+{
+	const double c = strtol(std::string(hex, 2).c_str(), NULL, 16) / 255.0;
+	return (c <= 0.04045) ? c / 12.92 : pow((c + 0.055) / 1.055, 2.4);
+}
+
+/* Write the indexed mesh as binary glTF (GLB).
+   Every solid becomes a node with its own mesh, and every STEP face a
+   primitive of that mesh, with the face's color (as in write_faces_scad).
+   The mesh should be built with weld_faces=false: every face then has its
+   own range of vertices, and the normals are not smoothed over the edges
+   between faces. */
+bool write_glb(const Indexed_mesh& mesh, std::ostream& ostrm,
+	       const Writer_options& opts)
+{
+	vector<Glb_primitive> prims;
+	vector< vector<size_t> > solids;    // primitives of every solid
+	for (size_t f=0;f<mesh.faces.size();++f) {
+		if (mesh.faces[f].count == 0)
+			continue;
+		if (mesh.faces[f].solid >= solids.size())
+			solids.resize(mesh.faces[f].solid + 1);
+		solids[mesh.faces[f].solid].push_back(prims.size());
+		Glb_primitive p;
+		p.face = f;
+		prims.push_back(p);
+	}
+
+	/* Vertex ranges, bounding boxes (required for positions) and
+	   area-weighted vertex normals of every face */
+	const size_t nv = mesh.vertices.size();
+	vector<float> normals(nv * 3);
+	parallel_for(prims.size(), opts.threads, [&](size_t i) {
+		Glb_primitive &p = prims[i];
+		const Mesh_face &mf = mesh.faces[p.face];
+		const uint32_t* idx = &mesh.indices[mf.first * 3];
+		const size_t n = mf.count * 3;
+
+		const uint32_t first = *min_element(idx, idx + n);
+		const uint32_t last = *max_element(idx, idx + n);
+		p.first_vertex = first;
+		p.vertices = last - first + 1;
+
+		for (int k=0;k<3;++k) {
+			p.min[k] = numeric_limits<float>::max();
+			p.max[k] = -numeric_limits<float>::max();
+		}
+		for (uint32_t v=first;v<=last;++v) {
+			const Point &pt = mesh.vertices[v];
+			const float c[3] = { (float)pt.x(), (float)pt.y(), (float)pt.z() };
+			for (int k=0;k<3;++k) {
+				p.min[k] = min(p.min[k], c[k]);
+				p.max[k] = max(p.max[k], c[k]);
+			}
+		}
+
+		vector<double> acc(p.vertices * 3, 0.0);
+		for (size_t t=0;t<n;t+=3) {
+			const Point &a = mesh.vertices[idx[t]];
+			const Point &b = mesh.vertices[idx[t+1]];
+			const Point &c = mesh.vertices[idx[t+2]];
+			const double ux = b.x()-a.x(), uy = b.y()-a.y(), uz = b.z()-a.z();
+			const double vx = c.x()-a.x(), vy = c.y()-a.y(), vz = c.z()-a.z();
+			const double nx = uy*vz - uz*vy, ny = uz*vx - ux*vz, nz = ux*vy - uy*vx;
+			for (int k=0;k<3;++k) {
+				double* an = &acc[(idx[t+k] - first) * 3];
+				an[0] += nx;
+				an[1] += ny;
+				an[2] += nz;
+			}
+		}
+		for (uint32_t v=0;v<p.vertices;++v) {
+			const double* an = &acc[v * 3];
+			const double len = sqrt(an[0]*an[0] + an[1]*an[1] + an[2]*an[2]);
+			float* out = &normals[(first + v) * 3];
+			if (len > 0) {
+				out[0] = (float)(an[0] / len);
+				out[1] = (float)(an[1] / len);
+				out[2] = (float)(an[2] / len);
+			} else {
+				out[0] = out[1] = 0;
+				out[2] = 1;
+			}
+		}
+	});
+
+	const unsigned long long positions_size = nv * 12ULL;
+	const unsigned long long indices_size = mesh.triangles() * 12ULL;
+	const unsigned long long bin_size = positions_size * 2 + indices_size;
+
+	std::ostringstream json;
+	json.precision(numeric_limits<float>::max_digits10);
+	json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"openscad-step-reader\"},";
+	json << "\"scene\":0,\"scenes\":[{\"nodes\":[0]}],";
+
+	// Root node: STEP is Z-up, glTF is Y-up
+	json << "\"nodes\":[{\"rotation\":[-0.70710678,0,0,0.70710678]";
+	size_t meshes = 0;
+	for (auto &sp : solids)
+		meshes += !sp.empty();
+	if (meshes) {
+		json << ",\"children\":[";
+		for (size_t i=0;i<meshes;++i)
+			json << (i ? "," : "") << (i+1);
+		json << "]";
+	}
+	json << "}";
+	for (size_t s=0, m=0;s<solids.size();++s) {
+		if (solids[s].empty())
+			continue;
+		json << ",{\"name\":\"solid_" << (s+1) << "\",\"mesh\":" << m++ << "}";
+	}
+	json << "]";
+
+	if (meshes) {
+		json << ",\"meshes\":[";
+		bool first_mesh = true;
+		for (auto &sp : solids) {
+			if (sp.empty())
+				continue;
+			json << (first_mesh ? "" : ",") << "{\"primitives\":[";
+			first_mesh = false;
+			for (size_t j=0;j<sp.size();++j) {
+				const size_t a = sp[j] * 3;
+				json << (j ? "," : "")
+				     << "{\"attributes\":{\"POSITION\":" << a << ",\"NORMAL\":" << (a+1) << "},"
+				     << "\"indices\":" << (a+2) << ","
+				     << "\"material\":" << face_color(prims[sp[j]].face) << ",\"mode\":4}";
+			}
+			json << "]}";
+		}
+		json << "]";
+
+		json << ",\"materials\":[";
+		for (size_t i=0;i<NUM_COLORS;++i) {
+			const char* rgb = colors_rgb[i] + 1;
+			json << (i ? "," : "") << "{\"name\":\"" << colors[i] << "\","
+			     << "\"pbrMetallicRoughness\":{\"baseColorFactor\":["
+			     << srgb_to_linear(rgb) << "," << srgb_to_linear(rgb+2) << ","
+			     << srgb_to_linear(rgb+4) << ",1],"
+			     << "\"metallicFactor\":0,\"roughnessFactor\":0.8}}";
+		}
+		json << "]";
+
+		json << ",\"buffers\":[{\"byteLength\":" << bin_size << "}]";
+		json << ",\"bufferViews\":["
+		     << "{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" << positions_size
+		     << ",\"byteStride\":12,\"target\":34962},"
+		     << "{\"buffer\":0,\"byteOffset\":" << positions_size << ",\"byteLength\":" << positions_size
+		     << ",\"byteStride\":12,\"target\":34962},"
+		     << "{\"buffer\":0,\"byteOffset\":" << positions_size * 2 << ",\"byteLength\":" << indices_size
+		     << ",\"target\":34963}]";
+
+		json << ",\"accessors\":[";
+		for (size_t i=0;i<prims.size();++i) {
+			const Glb_primitive &p = prims[i];
+			const Mesh_face &mf = mesh.faces[p.face];
+			json << (i ? "," : "")
+			     << "{\"bufferView\":0,\"byteOffset\":" << p.first_vertex * 12ULL
+			     << ",\"componentType\":5126,\"count\":" << p.vertices << ",\"type\":\"VEC3\","
+			     << "\"min\":[" << p.min[0] << "," << p.min[1] << "," << p.min[2] << "],"
+			     << "\"max\":[" << p.max[0] << "," << p.max[1] << "," << p.max[2] << "]},"
+			     << "{\"bufferView\":1,\"byteOffset\":" << p.first_vertex * 12ULL
+			     << ",\"componentType\":5126,\"count\":" << p.vertices << ",\"type\":\"VEC3\"},"
+			     << "{\"bufferView\":2,\"byteOffset\":" << mf.first * 12ULL
+			     << ",\"componentType\":5125,\"count\":" << mf.count * 3 << ",\"type\":\"SCALAR\"}";
+		}
+		json << "]";
+	}
+	json << "}";
+
+	// Chunks are 4-byte aligned, JSON is padded with spaces
+	std::string json_text = json.str();
+	json_text.resize((json_text.size() + 3) / 4 * 4, ' ');
+
+	const unsigned long long total = 12 + 8 + json_text.size()
+		+ (meshes ? 8 + bin_size : 0);
+	if (total > 0xFFFFFFFFULL) {
+		cerr << "The mesh is too large for a GLB file (over 4GB)" << endl;
+		return false;
+	}
+
+	Binary_writer out(ostrm);
+	out.put_le((uint32_t)0x46546C67);    // "glTF"
+	out.put_le((uint32_t)2);
+	out.put_le((uint32_t)total);
+	out.put_le((uint32_t)json_text.size());
+	out.put_le((uint32_t)0x4E4F534A);    // "JSON"
+	out.flush();
+	ostrm.write(json_text.data(), json_text.size());
+
+	if (meshes) {
+		out.put_le((uint32_t)bin_size);
+		out.put_le((uint32_t)0x004E4942);    // "BIN"
+		for (auto &v : mesh.vertices) {
+			out.put_le((float)v.x());
+			out.put_le((float)v.y());
+			out.put_le((float)v.z());
+		}
+		for (auto n : normals)
+			out.put_le(n);
+		// Indices are relative to the first vertex of each face
+		for (auto &p : prims) {
+			const Mesh_face &mf = mesh.faces[p.face];
+			for (size_t i=mf.first*3;i<(mf.first+mf.count)*3;++i)
+				out.put_le(mesh.indices[i] - p.first_vertex);
+		}
+	}
+	out.flush();
+	return !ostrm.fail();
 }
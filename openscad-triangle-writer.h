@@ -14,11 +14,45 @@
 #ifndef __OPENSCAD_TRIANGLE_WRITER__
 #define __OPENSCAD_TRIANGLE_WRITER__
 
-void write_faces_scad (const Face_vector& faces);
+/* Options shared by the writers */
+struct Writer_options {
+	unsigned threads;   // >1: format the output in pieces, on multiple threads
+	bool compact_faces; // SCAD faces vectors as list comprehensions
 
-void write_triangles_ascii_stl(const Face_vector& faces);
+	Writer_options() : threads(1), compact_faces(false) {};
+};
 
-void write_triangle_scad(const Face_vector& faces);
+void write_faces_scad (const Face_vector& faces, std::ostream& ostrm,
+		       const Writer_options& opts = Writer_options());
+
+void write_triangles_ascii_stl(const Face_vector& faces, std::ostream& ostrm,
+			       const Writer_options& opts = Writer_options());
+
+void write_triangle_scad(const Face_vector& faces, std::ostream& ostrm,
+			 const Writer_options& opts = Writer_options());
+
+void write_obj(const Indexed_mesh& mesh, std::ostream& ostrm,
+	       const Writer_options& opts = Writer_options());
+
+void write_ply(const Indexed_mesh& mesh, std::ostream& ostrm);
+
+void write_binary_stl(const Face_vector& faces, std::ostream& ostrm);
+
+/* Only the faces listed in 'selection' */
+void write_binary_stl(const Face_vector& faces, const std::vector<size_t>& selection,
+		      std::ostream& ostrm);
+
+/* The color write_faces_scad uses for face number 'face' (0-based) */
+const char* face_color_name(size_t face);
+
+/* Returns false (and prints an error to STDERR) if writing failed */
+bool write_3mf(const Indexed_mesh& mesh, std::ostream& ostrm,
+	       const Writer_options& opts = Writer_options());
+
+/* 'mesh' should be built with weld_faces=false.
+   Returns false (and prints an error to STDERR) if the mesh is too large. */
+bool write_glb(const Indexed_mesh& mesh, std::ostream& ostrm,
+	       const Writer_options& opts = Writer_options());
 
 
 #endif
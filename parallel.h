@@ -0,0 +1,94 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __PARALLEL__
+#define __PARALLEL__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Number of threads to use when the user didn't specify one */
+static inline unsigned hardware_threads()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	return n ? n : 1;
+}
+
+/* Call fn(i) for every i in [0,count), distributing the indexes
+   over up to 'threads' threads (work is picked dynamically, so
+   items of uneven cost are balanced).
+   With threads<=1 everything runs on the calling thread. */
+template<class Fn>
+void parallel_for(size_t count, unsigned threads, Fn fn)
+{
+	if (threads > count)
+		threads = (unsigned)count;
+	if (threads <= 1) {
+		for (size_t i=0;i<count;++i)
+			fn(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++)
+			fn(i);
+	};
+
+	std::vector<std::thread> pool;
+	for (unsigned t=1;t<threads;++t)
+		pool.push_back(std::thread(worker));
+	worker();
+	for (auto &th : pool)
+		th.join();
+}
+
+/* Format 'count' pieces of output on up to 'threads' threads, and write
+   them to 'ostrm' in order. fn(std::ostream&, i) formats piece i.
+   Every piece is formatted into its own buffer (with the formatting
+   flags/precision of 'ostrm'), so the output is byte-identical to
+   calling fn(ostrm, i) for every i in sequence. */
+template<class Fn>
+void write_ordered_parallel(std::ostream& ostrm, size_t count, unsigned threads, Fn fn)
+{
+	if (threads <= 1 || count <= 1) {
+		for (size_t i=0;i<count;++i)
+			fn(ostrm, i);
+		return;
+	}
+
+	// Format a few pieces per thread at a time, to bound memory usage.
+	const size_t window = (size_t)threads * 4;
+	std::vector<std::string> buffers(window);
+	for (size_t base=0; base<count; base+=window) {
+		const size_t n = std::min(window, count - base);
+		parallel_for(n, threads, [&](size_t i) {
+			std::ostringstream piece;
+			piece.copyfmt(ostrm);
+			fn(piece, base + i);
+			buffers[i] = piece.str();
+		});
+		for (size_t i=0;i<n;++i) {
+			ostrm.write(buffers[i].data(), buffers[i].size());
+			std::string().swap(buffers[i]);
+		}
+	}
+}
+
+#endif
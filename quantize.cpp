@@ -0,0 +1,105 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+#include <vector>
+
+#include <gp_Pnt.hxx>
+
+#include "triangle.h"
+#include "quantize.h"
+#include "parallel.h"
+
+using namespace std;
+
+Bounding_box::Bounding_box() : empty(true)
+{
+	for (int k=0;k<3;++k) {
+		min[k] = HUGE_VAL;
+		max[k] = -HUGE_VAL;
+	}
+}
+
+void Bounding_box::add(const Point& p)
+{
+	const double c[3] = { p.x(), p.y(), p.z() };
+	for (int k=0;k<3;++k) {
+		min[k] = std::min(min[k], c[k]);
+		max[k] = std::max(max[k], c[k]);
+	}
+	empty = false;
+}
+
+void Bounding_box::add(const Bounding_box& other)
+{
+	if (other.empty)
+		return;
+	for (int k=0;k<3;++k) {
+		min[k] = std::min(min[k], other.min[k]);
+		max[k] = std::max(max[k], other.max[k]);
+	}
+	empty = false;
+}
+
+Bounding_box faces_bounding_box(const Face_vector& faces, unsigned threads)
+{
+	vector<Bounding_box> boxes(faces.size());
+	parallel_for(faces.size(), threads, [&](size_t i) {
+		const Face &f = faces[i];
+		for (size_t t=0;t<f.size();++t) {
+			boxes[i].add(f[t].p1());
+			boxes[i].add(f[t].p2());
+			boxes[i].add(f[t].p3());
+		}
+	});
+
+	Bounding_box box;
+	for (auto &b : boxes)
+		box.add(b);
+	return box;
+}
+
+double quantize_faces(Face_vector& faces, unsigned bits, unsigned threads)
+{
+	const Bounding_box box = faces_bounding_box(faces, threads);
+	if (box.empty)
+		return 0;
+
+	double extent = 0;
+	for (int k=0;k<3;++k)
+		extent = max(extent, box.max[k] - box.min[k]);
+	if (extent <= 0)
+		return 0;
+
+	const double step = extent / ldexp(1.0, bits);
+	auto snap = [&](double v, int k) {
+		return box.min[k] + floor((v - box.min[k]) / step + 0.5) * step;
+	};
+
+	parallel_for(faces.size(), threads, [&](size_t i) {
+		faces[i].for_each_point([&](Point& p) {
+			p = Point(snap(p.x(), 0), snap(p.y(), 1), snap(p.z(), 2));
+		});
+	});
+	return step;
+}
+
+int grid_decimals(double step)
+{
+	if (step <= 0)
+		return 6;
+	// Rounding to 10^-decimals moves points by at most half a step
+	return max(0, min(17, (int)ceil(-log10(step))));
+}
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __QUANTIZE__
+#define __QUANTIZE__
+
+/* Axis-aligned bounding box */
+struct Bounding_box {
+	double min[3];
+	double max[3];
+	bool empty;
+
+	Bounding_box();
+	void add(const Point& p);
+	void add(const Bounding_box& other);
+};
+
+Bounding_box faces_bounding_box(const Face_vector& faces, unsigned threads = 1);
+
+/* Snap every point to a grid of 2^bits steps along the longest side of
+   the bounding box (starting at its minimum corner). Nearly identical
+   points (e.g. on the shared edge of two faces) become identical.
+   Returns the grid step (0 if there are no points). */
+double quantize_faces(Face_vector& faces, unsigned bits, unsigned threads = 1);
+
+/* Number of decimals needed to print distinct points of a grid with 'step' */
+int grid_decimals(double step);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <gp_Pnt.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+#include "step-reader-c.h"
+#include "shm-output.h"
+
+using namespace std;
+
+/* Every array starts on its own cache line */
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + 63) & ~(uint64_t)63;
+}
+
+#ifndef _WIN32
+
+/* Create a new segment with a name which isn't used yet */
+static int create_segment(string& name)
+{
+	for (unsigned attempt=0; attempt<100; ++attempt) {
+		ostringstream n;
+		n << "/openscad-step-reader." << getpid() << "." << attempt;
+		const int fd = shm_open(n.str().c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd != -1 || errno != EEXIST) {
+			name = n.str();
+			return fd;
+		}
+	}
+	errno = EEXIST;
+	return -1;
+}
+
+bool write_shm_mesh(const Indexed_mesh& mesh, std::string& name)
+{
+	stepreader_shm_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, STEPREADER_SHM_MAGIC, sizeof(h.magic));
+	h.version = STEPREADER_SHM_VERSION;
+	h.header_size = sizeof(h);
+	h.vertex_count = mesh.vertices.size();
+	h.triangle_count = mesh.triangles();
+	h.face_count = mesh.faces.size();
+	h.vertices = align_offset(sizeof(h));
+	h.indices = align_offset(h.vertices + h.vertex_count * 3 * sizeof(double));
+	h.faces = align_offset(h.indices + h.triangle_count * 3 * sizeof(uint32_t));
+	h.size = h.faces + h.face_count * 3 * sizeof(uint64_t);
+
+	const int fd = create_segment(name);
+	if (fd == -1) {
+		cerr << "Failed to create shared memory segment: " << strerror(errno) << endl;
+		return false;
+	}
+
+	/* ftruncate() alone reserves no pages on tmpfs: when /dev/shm is too
+	   small the copy below would die with SIGBUS, leaving the segment behind */
+#ifdef __APPLE__
+	const int err = (ftruncate(fd, (off_t)h.size) == 0) ? 0 : errno;
+#else
+	const int err = posix_fallocate(fd, 0, (off_t)h.size);
+#endif
+	if (err != 0) {
+		cerr << "Failed to allocate shared memory segment '" << name << "' ("
+		     << h.size << " bytes): " << strerror(err) << endl;
+		close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+
+	void* p = mmap(NULL, h.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		cerr << "Failed to map shared memory segment '" << name << "' ("
+		     << h.size << " bytes): " << strerror(errno) << endl;
+		close(fd);
+		shm_unlink(name.c_str());
+		return false;
+	}
+	close(fd);
+
+	char* base = (char*)p;
+	memcpy(base, &h, sizeof(h));
+
+	double* v = (double*)(base + h.vertices);
+	for (auto &pt : mesh.vertices) {
+		*v++ = pt.x();
+		*v++ = pt.y();
+		*v++ = pt.z();
+	}
+
+	if (!mesh.indices.empty())
+		memcpy(base + h.indices, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+
+	uint64_t* f = (uint64_t*)(base + h.faces);
+	for (auto &mf : mesh.faces) {
+		*f++ = mf.first;
+		*f++ = mf.count;
+		*f++ = mf.solid;
+	}
+
+	munmap(p, h.size);
+	return true;
+}
+
+#else
+
+bool write_shm_mesh(const Indexed_mesh&, std::string&)
+{
+	cerr << "Shared memory output is not supported on Windows" << endl;
+	return false;
+}
+
+#endif
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __SHM_OUTPUT__
+#define __SHM_OUTPUT__
+
+#include <string>
+
+/* Write the mesh into a new POSIX shared-memory segment (see
+   stepreader_shm_header in step-reader-c.h) and return its name in
+   'name'. The segment outlives this process, the consumer maps it and
+   removes it with shm_unlink().
+   Returns false (and prints an error to STDERR) on failure. */
+bool write_shm_mesh(const Indexed_mesh& mesh, std::string& name);
+
+#endif
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gp_Pnt.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+#include "openscad-triangle-writer.h"
+#include "file-output.h"
+#include "sidecar-output.h"
+
+using namespace std;
+
+/* Write the selected faces into a binary STL file */
+static bool write_sidecar(const Face_vector& faces, const vector<size_t>& selection,
+			  const string& filename)
+{
+	File_streambuf file;
+	if (!file.open(filename))
+		return false;
+	std::ostream out(&file);
+	write_binary_stl(faces, selection, out);
+	return file.close();
+}
+
+/* The file name without its directory (import() paths are relative
+   to the SCAD file) */
+static string base_name(const string& path)
+{
+	const size_t slash = path.find_last_of("/\\");
+	return (slash == string::npos) ? path : path.substr(slash + 1);
+}
+
+/* Quote a string for SCAD code */
+static string scad_string(const string& s)
+{
+	string q = "\"";
+	for (auto c : s) {
+		if (c == '"' || c == '\\')
+			q += '\\';
+		q += c;
+	}
+	return q + "\"";
+}
+
+bool write_scad_sidecars(const Face_vector& faces, const std::string& scad_filename,
+			 bool per_color, std::ostream& ostrm)
+{
+	string stem = scad_filename;
+	const string ext = ".scad";
+	if (stem.size() > ext.size() && stem.compare(stem.size() - ext.size(), ext.size(), ext) == 0)
+		stem.resize(stem.size() - ext.size());
+
+	vector<size_t> all;
+	for (size_t i=0;i<faces.size();++i)
+		all.push_back(i);
+	const string mesh_file = stem + ".stl";
+	if (!write_sidecar(faces, all, mesh_file))
+		return false;
+
+	if (per_color) {
+		// Group the non-empty faces by color, in order of appearance
+		vector< pair<string, vector<size_t> > > groups;
+		for (size_t i=0;i<faces.size();++i) {
+			if (faces[i].size() == 0)
+				continue;
+			const string color = face_color_name(i);
+			size_t g = 0;
+			while (g < groups.size() && groups[g].first != color)
+				++g;
+			if (g == groups.size())
+				groups.push_back(make_pair(color, vector<size_t>()));
+			groups[g].second.push_back(i);
+		}
+
+		/* crazy colors version, draw each group of faces by itself */
+		ostrm << "module crazy_colors() {" << endl;
+		for (auto &g : groups) {
+			const string file = stem + "-" + g.first + ".stl";
+			if (!write_sidecar(faces, g.second, file))
+				return false;
+			ostrm << "color(" << scad_string(g.first) << ")" << endl;
+			ostrm << "import(" << scad_string(base_name(file)) << ");" << endl;
+		}
+		ostrm << "}" << endl;
+	}
+
+	ostrm << "module solid_object() {" << endl;
+	ostrm << "  import(" << scad_string(base_name(mesh_file)) << ");" << endl;
+	ostrm << "}" << endl;
+	ostrm << endl;
+
+	if (per_color) {
+		ostrm << endl;
+		ostrm << "if ($preview) {;" << endl;
+		ostrm << "  crazy_colors();" << endl;
+		ostrm << "} else {" << endl;
+		ostrm << "  solid_object();" << endl;
+		ostrm << "}" << endl;
+	}
+	else
+		ostrm << "solid_object();" << endl;
+
+	return true;
+}
+
+void write_scad_lod_index(const std::vector<std::string>& lod_files,
+			  const std::vector<double>& tolerances, std::ostream& ostrm)
+{
+	if (lod_files.empty())
+		return;
+
+	ostrm << "// Levels of detail (linear tolerance):";
+	for (size_t i=0;i<lod_files.size();++i)
+		ostrm << (i ? ", " : " ") << i << " = " << tolerances[i];
+	ostrm << endl;
+	ostrm << "lod = $preview ? 0 : " << (lod_files.size() - 1) << ";" << endl;
+	ostrm << endl;
+
+	// include<> is textual, each level's points/faces/modules stay local to its block
+	for (size_t i=0;i<lod_files.size();++i) {
+		if (i > 0)
+			ostrm << "else ";
+		ostrm << "if (lod == " << i << ") {" << endl;
+		ostrm << "include <" << base_name(lod_files[i]) << ">" << endl;
+		ostrm << "}" << endl;
+	}
+}
+
+void write_scad_solid_index(const std::vector<std::string>& solid_files, std::ostream& ostrm)
+{
+	ostrm << "// Solids, one file each" << endl;
+	for (size_t i=0;i<solid_files.size();++i)
+		ostrm << "solid_" << i << " = true;" << endl;
+	ostrm << endl;
+
+	// As in write_scad_lod_index, every block keeps its solid's modules local
+	for (size_t i=0;i<solid_files.size();++i) {
+		ostrm << "if (solid_" << i << ") {" << endl;
+		ostrm << "include <" << base_name(solid_files[i]) << ">" << endl;
+		ostrm << "}" << endl;
+	}
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __SIDECAR_OUTPUT__
+#define __SIDECAR_OUTPUT__
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+/* Write SCAD code which import()s the mesh from binary STL files written
+   next to the SCAD file ("sidecars"), instead of inlining it as
+   points/faces vectors - OpenSCAD's STL importer is much faster than
+   its parser for huge vector literals.
+
+   The sidecar names are derived from 'scad_filename'
+   (e.g. "part.scad" -> "part.stl").
+   With 'per_color', the faces are also grouped by their write_faces_scad
+   color, into one sidecar per color (e.g. "part-Violet.stl"), which the
+   $preview code imports in that color.
+
+   Returns false (and prints an error to STDERR) on failure. */
+bool write_scad_sidecars(const Face_vector& faces, const std::string& scad_filename,
+			 bool per_color, std::ostream& ostrm);
+
+/* Write SCAD code which include<>s one of 'lod_files' (SCAD files of the
+   same part, meshed with 'tolerances', coarsest first): the coarsest in
+   $preview mode, the finest when rendering. The 'lod' variable can be
+   overridden (e.g. 'openscad -D lod=1') to force a level. */
+void write_scad_lod_index(const std::vector<std::string>& lod_files,
+			  const std::vector<double>& tolerances, std::ostream& ostrm);
+
+/* Write SCAD code which include<>s all of 'solid_files' (SCAD files of
+   the solids of one STEP file). Every solid has a variable which can be
+   overridden to hide it (e.g. 'openscad -D solid_1=false'). */
+void write_scad_solid_index(const std::vector<std::string>& solid_files, std::ostream& ostrm);
+
+#endif
@@ -0,0 +1,550 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "compressed-input.h"
+#include "parallel.h"
+#include "step-index.h"
+
+using namespace std;
+
+/* Location of one '#N=...;' instance record in the STEP text
+   (for the duplicate and reference checks) */
+struct Step_entity {
+	size_t id;
+	size_t offset;
+	size_t length;
+};
+
+/* A minimal ISO 10303-21 tokenizer: it only understands enough of the
+   syntax (strings, comments, keywords, record terminators) to find
+   the type name(s) of every entity instance. Parameters are skipped,
+   not parsed. */
+
+static inline bool is_space(char c)
+{
+	return c==' ' || c=='\n' || c=='\r' || c=='\t';
+}
+
+static inline bool is_digit(char c)
+{
+	return c>='0' && c<='9';
+}
+
+static inline bool is_keyword_char(char c)
+{
+	return (c>='A' && c<='Z') || (c>='a' && c<='z') || is_digit(c)
+		|| c=='_' || c=='!' || c=='-';
+}
+
+static const char* skip_comment(const char* p, const char* end)
+{
+	// 'p' points to the "/*"
+	p += 2;
+	while (p+1 < end && !(p[0]=='*' && p[1]=='/'))
+		++p;
+	return (p+1 < end) ? p+2 : end;
+}
+
+static const char* skip_string(const char* p, const char* end)
+{
+	// 'p' points to the opening quote. Quotes are escaped by doubling them.
+	++p;
+	while (p < end) {
+		const char* q = (const char*)memchr(p, '\'', end-p);
+		if (!q)
+			return end;
+		if (q+1 < end && q[1]=='\'') {
+			p = q+2;
+			continue;
+		}
+		return q+1;
+	}
+	return end;
+}
+
+static const char* skip_space(const char* p, const char* end)
+{
+	while (p < end) {
+		if (is_space(*p))
+			++p;
+		else if (*p=='/' && p+1<end && p[1]=='*')
+			p = skip_comment(p, end);
+		else
+			break;
+	}
+	return p;
+}
+
+/* Returns a pointer just after the ';' terminating the current record. */
+static const char* skip_record(const char* p, const char* end)
+{
+	while (p < end) {
+		const char c = *p;
+		if (c==';')
+			return p+1;
+		if (c=='\'')
+			p = skip_string(p, end);
+		else if (c=='/' && p+1<end && p[1]=='*')
+			p = skip_comment(p, end);
+		else
+			++p;
+	}
+	return end;
+}
+
+/* Same as skip_record, but also checks the parentheses are balanced. */
+static const char* skip_record_checked(const char* p, const char* end, bool &balanced)
+{
+	int depth = 0;
+	balanced = true;
+	while (p < end) {
+		const char c = *p;
+		if (c==';') {
+			balanced = balanced && (depth==0);
+			return p+1;
+		}
+		if (c=='\'') {
+			p = skip_string(p, end);
+			continue;
+		}
+		if (c=='/' && p+1<end && p[1]=='*') {
+			p = skip_comment(p, end);
+			continue;
+		}
+		if (c=='(')
+			++depth;
+		else if (c==')' && --depth<0)
+			balanced = false;
+		++p;
+	}
+	balanced = false;
+	return end;
+}
+
+/* Returns a pointer just after the ')' matching the '(' at 'p'. */
+static const char* skip_parens(const char* p, const char* end)
+{
+	int depth = 0;
+	while (p < end) {
+		const char c = *p;
+		if (c=='\'') {
+			p = skip_string(p, end);
+			continue;
+		}
+		if (c=='/' && p+1<end && p[1]=='*') {
+			p = skip_comment(p, end);
+			continue;
+		}
+		if (c==';')
+			break; // Malformed record, don't run past it.
+		++p;
+		if (c=='(')
+			++depth;
+		else if (c==')' && --depth==0)
+			break;
+	}
+	return p;
+}
+
+static const char* read_keyword(const char* p, const char* end, string& kw)
+{
+	kw.clear();
+	while (p < end && is_keyword_char(*p)) {
+		char c = *p++;
+		if (c>='a' && c<='z')
+			c = c - 'a' + 'A';
+		kw += c;
+	}
+	return p;
+}
+
+/* Decode the first quoted string in the record starting at 'p'. */
+static string first_string(const char* p, const char* end)
+{
+	string s;
+	const char* rec_end = skip_record(p, end);
+	while (p < rec_end && *p!='\'')
+		++p;
+	if (p >= rec_end)
+		return s;
+	const char* str_end = skip_string(p, rec_end);
+	for (++p; p < str_end-1; ++p) {
+		s += *p;
+		if (*p=='\'')
+			++p; // skip the escaping quote
+	}
+	return s;
+}
+
+static bool is_bspline_surface_type(const string& t)
+{
+	return t.compare(0, 16, "B_SPLINE_SURFACE")==0
+		|| t=="RATIONAL_B_SPLINE_SURFACE"
+		|| t=="BEZIER_SURFACE"
+		|| t=="UNIFORM_SURFACE"
+		|| t=="QUASI_UNIFORM_SURFACE";
+}
+
+
+/* Results of scanning one piece of the DATA section */
+struct Chunk {
+	const char* begin;   // first record scanned
+	const char* limit;   // nominal end (begin of the next chunk)
+	const char* stop;    // where scanning actually ended
+	Step_info info;
+	vector<Step_entity> entities;
+	vector<Step_error> errors;
+};
+
+#define MAX_ERRORS_PER_CHUNK 100
+
+static void add_error(Chunk& c, size_t offset, const string& msg)
+{
+	if (c.errors.size() < MAX_ERRORS_PER_CHUNK) {
+		Step_error e = { offset, msg };
+		c.errors.push_back(e);
+	}
+}
+
+/* Scan one '#N=...;' instance record, 'p' points to the '#'. */
+static const char* scan_instance(const char* p, const char* end, const char* base,
+				 Step_scan_mode mode, Chunk& c, string& kw)
+{
+	const char* rec = p;
+	const bool validate = (mode == STEP_SCAN_VALIDATE);
+	bool valid = true;
+
+	++p;
+	size_t id = 0;
+	const char* digits = p;
+	while (p < end && is_digit(*p))
+		id = id*10 + (*p++ - '0');
+	valid = (p != digits);
+	p = skip_space(p, end);
+	if (p < end && *p=='=')
+		p = skip_space(p+1, end);
+	else
+		valid = false;
+
+	bool advanced_face = false;
+	bool bspline = false;
+	bool product = false;
+
+	if (p < end && *p=='(') {
+		// Complex instance: (TYPE_A(...) TYPE_B(...) ...)
+		p = skip_space(p+1, end);
+		while (p < end && *p!=')' && *p!=';') {
+			const char* next = read_keyword(p, end, kw);
+			if (next == p) {
+				valid = false;
+				break;
+			}
+			++c.info.type_counts[kw];
+			bspline |= is_bspline_surface_type(kw);
+			p = skip_space(next, end);
+			if (p < end && *p=='(')
+				p = skip_space(skip_parens(p, end), end);
+		}
+		if (p < end && *p==')')
+			++p;
+		else
+			valid = false;
+	} else {
+		const char* next = read_keyword(p, end, kw);
+		valid = valid && (next != p);
+		p = next;
+		++c.info.type_counts[kw];
+		advanced_face = (kw=="ADVANCED_FACE");
+		bspline = is_bspline_surface_type(kw);
+		product = (kw=="PRODUCT");
+	}
+
+	++c.info.entities;
+	c.info.advanced_faces += advanced_face;
+	c.info.bspline_surfaces += bspline;
+	c.info.products += product;
+
+	if (validate) {
+		bool balanced;
+		p = skip_record_checked(p, end, balanced);
+		if (!valid)
+			add_error(c, rec-base, "malformed entity instance");
+		else if (!balanced)
+			add_error(c, rec-base, "unbalanced parentheses or unterminated record in entity #"
+				  + to_string(id));
+	} else {
+		p = skip_record(p, end);
+	}
+
+	if (validate) {
+		Step_entity e = { id, (size_t)(rec-base), (size_t)(p-rec) };
+		c.entities.push_back(e);
+	}
+
+	return p;
+}
+
+static void scan_chunk(Chunk& c, const char* p, const char* end, const char* base,
+		       Step_scan_mode mode)
+{
+	string kw;
+
+	c.begin = p;
+	c.info = Step_info();
+	c.entities.clear();
+	c.errors.clear();
+
+	while (true) {
+		p = skip_space(p, end);
+		if (p >= c.limit)
+			break;
+
+		if (*p=='#') {
+			p = scan_instance(p, end, base, mode, c, kw);
+			continue;
+		}
+
+		// ENDSEC, additional DATA sections, etc.
+		const char* next = read_keyword(p, end, kw);
+		if (kw=="END-ISO-10303-21") {
+			p = end;
+			break;
+		}
+		p = skip_record(next, end);
+	}
+	c.stop = p;
+}
+
+/* Scan the HEADER section, returns a pointer just after the "DATA;" record
+   (or NULL if there isn't one). */
+static const char* scan_header(const char* p, const char* end, Step_info& info)
+{
+	string kw;
+	while (true) {
+		p = skip_space(p, end);
+		if (p >= end)
+			return NULL;
+
+		const char* next = read_keyword(p, end, kw);
+		if (kw=="FILE_NAME")
+			info.file_name = first_string(next, end);
+		else if (kw=="FILE_SCHEMA")
+			info.schema = first_string(next, end);
+
+		p = skip_record(next, end);
+		if (kw=="DATA")
+			return p;
+	}
+}
+
+/* Find a likely record boundary at or after 'p': a '#' following a ';'
+   (with only whitespace in between). This can be fooled by such text inside
+   a string - scan_step_text() detects and corrects that. */
+static const char* next_boundary(const char* p, const char* lo, const char* end)
+{
+	while (p < end) {
+		const char* q = (const char*)memchr(p, '#', end-p);
+		if (!q)
+			return end;
+		const char* r = q;
+		while (r > lo && is_space(r[-1]))
+			--r;
+		if (r > lo && r[-1]==';')
+			return q;
+		p = q+1;
+	}
+	return end;
+}
+
+static bool by_id(const Step_entity& a, const Step_entity& b)
+{
+	return a.id < b.id;
+}
+
+/* 'entities' is sorted by id */
+static bool entity_exists(const vector<Step_entity>& entities, size_t id)
+{
+	Step_entity key = { id, 0, 0 };
+	auto it = lower_bound(entities.begin(), entities.end(), key, by_id);
+	return it != entities.end() && it->id == id;
+}
+
+/* Check that every '#N' reference in the record points to an existing entity */
+static void check_references(const vector<Step_entity>& entities, const char* base,
+			     const Step_entity& e, Chunk& c)
+{
+	const char* p = base + e.offset;
+	const char* end = p + e.length;
+
+	p = (const char*)memchr(p, '=', end-p);
+	if (!p)
+		return;
+	while (p < end) {
+		const char ch = *p;
+		if (ch=='\'') {
+			p = skip_string(p, end);
+			continue;
+		}
+		if (ch=='/' && p+1<end && p[1]=='*') {
+			p = skip_comment(p, end);
+			continue;
+		}
+		++p;
+		if (ch!='#')
+			continue;
+
+		size_t id = 0;
+		const char* digits = p;
+		while (p < end && is_digit(*p))
+			id = id*10 + (*p++ - '0');
+		if (p==digits)
+			add_error(c, e.offset, "invalid reference in entity #" + to_string(e.id));
+		else if (!entity_exists(entities, id))
+			add_error(c, e.offset, "entity #" + to_string(e.id)
+				  + " references undefined entity #" + to_string(id));
+	}
+}
+
+static bool by_offset(const Step_error& a, const Step_error& b)
+{
+	return a.offset < b.offset;
+}
+
+bool scan_step_text(const char* data, size_t size, unsigned threads,
+		    Step_scan_mode mode, Step_scan& scan)
+{
+	const char* end = data + size;
+
+	if (threads == 0)
+		threads = hardware_threads();
+
+	scan = Step_scan();
+	scan.info.file_size = size;
+
+	const char* data_section = scan_header(data, end, scan.info);
+	if (!data_section)
+		return false;
+
+	// Split the DATA section in pieces of at least 1MB, a few per thread
+	// so that uneven pieces are balanced.
+	const size_t min_chunk = 1 << 20;
+	size_t nchunks = min((size_t)threads * 4, (size_t)(end - data_section) / min_chunk + 1);
+	vector<Chunk> chunks(nchunks);
+	const char* p = data_section;
+	for (size_t i=0;i<nchunks;++i) {
+		chunks[i].begin = p;
+		const char* guess = data_section + (end - data_section) * (i+1) / nchunks;
+		p = (i+1==nchunks) ? end : next_boundary(max(guess, p), data_section, end);
+		chunks[i].limit = p;
+	}
+
+	parallel_for(nchunks, threads, [&](size_t i) {
+		scan_chunk(chunks[i], chunks[i].begin, end, data, mode);
+	});
+
+	// A piece is valid only if the previous one ended exactly where it begins
+	// (otherwise its start was guessed inside a string). Rescan those.
+	const char* expected = data_section;
+	for (auto &c : chunks) {
+		if (c.begin != expected) {
+			if (expected < c.limit) {
+				scan_chunk(c, expected, end, data, mode);
+			} else {
+				c.info = Step_info();
+				c.entities.clear();
+				c.errors.clear();
+				c.stop = expected;
+			}
+		}
+		expected = c.stop;
+	}
+
+	// Merge
+	Step_info &info = scan.info;
+	vector<Step_entity> entities;
+	for (auto &c : chunks) {
+		info.entities += c.info.entities;
+		info.advanced_faces += c.info.advanced_faces;
+		info.bspline_surfaces += c.info.bspline_surfaces;
+		info.products += c.info.products;
+		for (auto &t : c.info.type_counts)
+			info.type_counts[t.first] += t.second;
+		entities.insert(entities.end(), c.entities.begin(), c.entities.end());
+		scan.errors.insert(scan.errors.end(), c.errors.begin(), c.errors.end());
+	}
+	chunks.clear();
+
+	if (mode == STEP_SCAN_COUNT)
+		return true;
+
+	if (!is_sorted(entities.begin(), entities.end(), by_id))
+		sort(entities.begin(), entities.end(), by_id);
+
+	for (size_t i=1;i<entities.size();++i) {
+		if (entities[i].id == entities[i-1].id) {
+			Step_error e = { entities[i].offset,
+					 "duplicated entity #" + to_string(entities[i].id) };
+			scan.errors.push_back(e);
+		}
+	}
+
+	const size_t block = 4096;
+	const size_t nblocks = (entities.size() + block - 1) / block;
+	vector<Chunk> ref_errors(nblocks);
+	parallel_for(nblocks, threads, [&](size_t b) {
+		const size_t last = min(entities.size(), (b+1)*block);
+		for (size_t i=b*block; i<last; ++i)
+			check_references(entities, data, entities[i], ref_errors[b]);
+	});
+	for (auto &c : ref_errors)
+		scan.errors.insert(scan.errors.end(), c.errors.begin(), c.errors.end());
+
+	stable_sort(scan.errors.begin(), scan.errors.end(), by_offset);
+	return true;
+}
+
+#define MAX_REPORTED_ERRORS 20
+
+bool validate_step_file(const std::string& filename, unsigned threads)
+{
+	Step_text file;
+	if (!file.open(filename))
+		return false;
+
+	Step_scan scan;
+	if (!scan_step_text(file.data(), file.size(), threads, STEP_SCAN_VALIDATE, scan)) {
+		cerr << "No DATA section found in STEP file '" << filename << "'" << endl;
+		return false;
+	}
+
+	// Errors are sorted by offset, count lines incrementally.
+	size_t line = 1;
+	size_t pos = 0;
+	for (size_t i=0;i<scan.errors.size() && i<MAX_REPORTED_ERRORS;++i) {
+		const Step_error &e = scan.errors[i];
+		line += count(file.data() + pos, file.data() + e.offset, '\n');
+		pos = e.offset;
+		cerr << filename << ":" << line << ": " << e.message << endl;
+	}
+	if (scan.errors.size() > MAX_REPORTED_ERRORS)
+		cerr << filename << ": " << (scan.errors.size() - MAX_REPORTED_ERRORS)
+		     << " more errors" << endl;
+
+	return scan.errors.empty();
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __STEP_INDEX__
+#define __STEP_INDEX__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "step-info.h"
+
+struct Step_error {
+	size_t offset;
+	std::string message;
+};
+
+struct Step_scan {
+	Step_info info;
+	std::vector<Step_error> errors;      // sorted by offset
+};
+
+enum Step_scan_mode {
+	STEP_SCAN_COUNT,      // Only gather Step_info statistics
+	STEP_SCAN_VALIDATE    // + check record syntax, duplicate IDs and references
+};
+
+/* Scan the STEP text, splitting the DATA section at entity boundaries
+   and tokenizing the pieces on up to 'threads' threads.
+   Returns false if no DATA section was found. */
+bool scan_step_text(const char* data, size_t size, unsigned threads,
+		    Step_scan_mode mode, Step_scan& scan);
+
+/* Map and validate the file, printing the first errors (with line numbers)
+   to STDERR. Returns false if the file is malformed. */
+bool validate_step_file(const std::string& filename, unsigned threads);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "compressed-input.h"
+#include "step-info.h"
+#include "step-index.h"
+
+using namespace std;
+
+static bool by_count_desc(const pair<string,size_t>& a, const pair<string,size_t>& b)
+{
+	if (a.second != b.second)
+		return a.second > b.second;
+	return a.first < b.first;
+}
+
+void write_step_info(std::ostream& ostrm, const Step_info& info)
+{
+	vector< pair<string,size_t> > types(info.type_counts.begin(), info.type_counts.end());
+	sort(types.begin(), types.end(), by_count_desc);
+
+	ostrm << "file_size: " << info.file_size << endl;
+	ostrm << "file_name: " << info.file_name << endl;
+	ostrm << "schema: " << info.schema << endl;
+	ostrm << "entities: " << info.entities << endl;
+	ostrm << "entity_types: " << types.size() << endl;
+	ostrm << "advanced_faces: " << info.advanced_faces << endl;
+	ostrm << "bspline_surfaces: " << info.bspline_surfaces << endl;
+	ostrm << "products: " << info.products << endl;
+	ostrm << "types:" << endl;
+	for (auto &t : types)
+		ostrm << "  " << t.first << " " << t.second << endl;
+}
+
+bool print_step_info(const std::string& filename, unsigned threads, std::ostream& ostrm)
+{
+	Step_text file;
+	if (!file.open(filename))
+		return false;
+
+	Step_scan scan;
+	if (!scan_step_text(file.data(), file.size(), threads, STEP_SCAN_COUNT, scan)) {
+		cerr << "No DATA section found in STEP file '" << filename << "'" << endl;
+		return false;
+	}
+
+	write_step_info(ostrm, scan.info);
+	return true;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __STEP_INFO__
+#define __STEP_INFO__
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+/* Statistics gathered by a quick scan of the STEP (ISO 10303-21) text,
+   without going through OpenCASCADE's reader/transfer. */
+struct Step_info {
+	size_t file_size;
+	std::string file_name;     // FILE_NAME's first parameter
+	std::string schema;        // FILE_SCHEMA's first identifier
+
+	size_t entities;           // Number of '#N=...' instances in the DATA section
+	size_t advanced_faces;
+	size_t bspline_surfaces;   // Instances with any B-Spline/Bezier surface type
+	size_t products;
+
+	// Instance count by entity type. Complex instances (#N=(A() B());)
+	// count once for every type they list.
+	std::unordered_map<std::string, size_t> type_counts;
+
+	Step_info() :
+		file_size(0), entities(0), advanced_faces(0),
+		bspline_surfaces(0), products(0) {};
+};
+
+void write_step_info(std::ostream& ostrm, const Step_info& info);
+
+/* Map the file, scan it (see scan_step_text) and write its statistics
+   to 'ostrm'. Returns false (after printing an error) on failure. */
+bool print_step_info(const std::string& filename, unsigned threads, std::ostream& ostrm);
+
+#endif
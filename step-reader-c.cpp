@@ -0,0 +1,220 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <string>
+
+#include <Standard_Failure.hxx>
+
+#include "step-reader.h"
+#include "step-reader-c.h"
+
+using namespace std;
+
+/* The zero-copy accessors return the Indexed_mesh buffers as they are */
+static_assert(sizeof(Point) == 3 * sizeof(double), "Point must be three packed doubles");
+static_assert(sizeof(Mesh_face) == sizeof(stepreader_face), "Mesh_face/stepreader_face mismatch");
+static_assert(offsetof(Mesh_face, first) == offsetof(stepreader_face, first) &&
+	      offsetof(Mesh_face, count) == offsetof(stepreader_face, count) &&
+	      offsetof(Mesh_face, solid) == offsetof(stepreader_face, solid),
+	      "Mesh_face/stepreader_face mismatch");
+
+struct stepreader {
+	Step_reader reader;
+	double tolerance;
+	bool weld_faces;
+	bool ready;
+	bool failed;
+	Indexed_mesh mesh;
+
+	stepreader() : tolerance(0.5), weld_faces(true), ready(false), failed(false) {};
+};
+
+/* No C++ exception may cross the C interface */
+template<class Fn>
+static int guarded(const char* what, Fn fn)
+{
+	try {
+		fn();
+		return 0;
+	}
+	catch (Standard_Failure& e) {
+		cerr << what << ": " << e.GetMessageString() << endl;
+	}
+	catch (std::exception& e) {
+		cerr << what << ": " << e.what() << endl;
+	}
+	catch (...) {
+		cerr << what << ": unknown error" << endl;
+	}
+	return -1;
+}
+
+static void discard_mesh(stepreader* r)
+{
+	r->mesh = Indexed_mesh();
+	r->ready = false;
+	r->failed = false;
+}
+
+/* Tessellate once; a failure is remembered until the settings change */
+static bool ensure_mesh(stepreader* r)
+{
+	if (!r)
+		return false;
+	if (r->ready)
+		return true;
+	if (r->failed)
+		return false;
+
+	r->failed = guarded("Failed to tessellate STEP file", [r]() {
+		r->reader.mesh(r->tolerance);
+		r->mesh = r->reader.indexed_mesh(r->weld_faces);
+	}) != 0;
+	r->ready = !r->failed;
+	return r->ready;
+}
+
+extern "C" {
+
+int stepreader_abi_version(void)
+{
+	return STEPREADER_ABI_VERSION;
+}
+
+stepreader* stepreader_open(const char* filename)
+{
+	if (!filename)
+		return NULL;
+
+	stepreader* r = NULL;
+	bool loaded = false;
+	guarded("Failed to load STEP file", [&]() {
+		r = new stepreader();
+		loaded = r->reader.load(filename);
+	});
+	if (!loaded) {
+		delete r;
+		return NULL;
+	}
+	return r;
+}
+
+void stepreader_close(stepreader* r)
+{
+	delete r;
+}
+
+int stepreader_set_tolerance(stepreader* r, double linear_tolerance)
+{
+	if (!r || !(linear_tolerance > 0)) {
+		cerr << "Invalid tolerance " << linear_tolerance << endl;
+		return -1;
+	}
+	if (linear_tolerance != r->tolerance) {
+		discard_mesh(r);
+		r->tolerance = linear_tolerance;
+	}
+	return 0;
+}
+
+int stepreader_set_weld_faces(stepreader* r, int weld)
+{
+	if (!r)
+		return -1;
+	if ((weld != 0) != r->weld_faces) {
+		discard_mesh(r);
+		r->weld_faces = (weld != 0);
+	}
+	return 0;
+}
+
+int stepreader_tessellate(stepreader* r)
+{
+	return ensure_mesh(r) ? 0 : -1;
+}
+
+size_t stepreader_vertex_count(stepreader* r)
+{
+	return ensure_mesh(r) ? r->mesh.vertices.size() : 0;
+}
+
+size_t stepreader_triangle_count(stepreader* r)
+{
+	return ensure_mesh(r) ? r->mesh.triangles() : 0;
+}
+
+size_t stepreader_face_count(stepreader* r)
+{
+	return ensure_mesh(r) ? r->mesh.faces.size() : 0;
+}
+
+int stepreader_get_vertices(stepreader* r, double* xyz)
+{
+	if (!xyz || !ensure_mesh(r))
+		return -1;
+	for (auto &p : r->mesh.vertices) {
+		*xyz++ = p.x();
+		*xyz++ = p.y();
+		*xyz++ = p.z();
+	}
+	return 0;
+}
+
+int stepreader_get_indices(stepreader* r, uint32_t* indices)
+{
+	if (!indices || !ensure_mesh(r))
+		return -1;
+	if (!r->mesh.indices.empty())
+		memcpy(indices, r->mesh.indices.data(), r->mesh.indices.size() * sizeof(uint32_t));
+	return 0;
+}
+
+int stepreader_get_faces(stepreader* r, stepreader_face* faces)
+{
+	if (!faces || !ensure_mesh(r))
+		return -1;
+	for (auto &f : r->mesh.faces) {
+		faces->first = f.first;
+		faces->count = f.count;
+		faces->solid = f.solid;
+		++faces;
+	}
+	return 0;
+}
+
+const double* stepreader_vertices(stepreader* r)
+{
+	if (!ensure_mesh(r) || r->mesh.vertices.empty())
+		return NULL;
+	return reinterpret_cast<const double*>(r->mesh.vertices.data());
+}
+
+const uint32_t* stepreader_indices(stepreader* r)
+{
+	if (!ensure_mesh(r) || r->mesh.indices.empty())
+		return NULL;
+	return r->mesh.indices.data();
+}
+
+const stepreader_face* stepreader_faces(stepreader* r)
+{
+	if (!ensure_mesh(r) || r->mesh.faces.empty())
+		return NULL;
+	return reinterpret_cast<const stepreader_face*>(r->mesh.faces.data());
+}
+
+}
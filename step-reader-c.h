@@ -0,0 +1,111 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __STEP_READER_C__
+#define __STEP_READER_C__
+
+/* C interface of libstepreader, for loading STEP files in-process
+   (e.g. from OpenSCAD's importer) without running openscad-step-reader.
+
+	stepreader* r = stepreader_open("part.stp");
+	if (!r)
+		return error;
+	stepreader_set_tolerance(r, 0.1);
+	size_t nv = stepreader_vertex_count(r);
+	size_t nt = stepreader_triangle_count(r);
+	const double* xyz = stepreader_vertices(r);    // nv*3 doubles
+	const uint32_t* idx = stepreader_indices(r);   // nt*3 indices
+	...
+	stepreader_close(r);
+
+   The mesh is tessellated on the first call which needs it. Functions
+   returning int return 0 on success and -1 on failure, errors are
+   printed to STDERR. A handle must not be used by two threads at once. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Incremented on incompatible changes of this interface */
+#define STEPREADER_ABI_VERSION 1
+
+typedef struct stepreader stepreader;
+
+/* The triangles of one STEP face */
+typedef struct stepreader_face {
+	size_t first;     // first triangle
+	size_t count;     // number of triangles
+	size_t solid;     // index of the solid containing the face
+} stepreader_face;
+
+int stepreader_abi_version(void);
+
+/* Load a STEP file (can be gzip/zstd-compressed). Returns NULL on failure. */
+stepreader* stepreader_open(const char* filename);
+void stepreader_close(stepreader* r);
+
+/* Maximum distance between the triangles and the surfaces, in model
+   units (default: 0.5). Changing it discards the current mesh. */
+int stepreader_set_tolerance(stepreader* r, double linear_tolerance);
+
+/* Share the vertices on the common edges of adjacent faces (default: 1).
+   With 0 every face has its own vertices. Changing it discards the current mesh. */
+int stepreader_set_weld_faces(stepreader* r, int weld);
+
+/* Tessellate now (otherwise done by the first function needing the mesh) */
+int stepreader_tessellate(stepreader* r);
+
+size_t stepreader_vertex_count(stepreader* r);
+size_t stepreader_triangle_count(stepreader* r);
+size_t stepreader_face_count(stepreader* r);
+
+/* Copy the mesh into caller-provided arrays of vertex_count()*3 doubles,
+   triangle_count()*3 indices and face_count() faces */
+int stepreader_get_vertices(stepreader* r, double* xyz);
+int stepreader_get_indices(stepreader* r, uint32_t* indices);
+int stepreader_get_faces(stepreader* r, stepreader_face* faces);
+
+/* Zero-copy access to the internal buffers (same layout as above).
+   Valid until the mesh is discarded (set_tolerance/set_weld_faces/close).
+   NULL if the mesh is empty or tessellation failed. */
+const double* stepreader_vertices(stepreader* r);
+const uint32_t* stepreader_indices(stepreader* r);
+const stepreader_face* stepreader_faces(stepreader* r);
+
+/* Layout of the shared-memory segments written by
+   'openscad-step-reader --shm' (in the byte order of the host).
+   The offsets are from the start of the segment. */
+#define STEPREADER_SHM_MAGIC "STEPMESH"
+#define STEPREADER_SHM_VERSION 1
+
+typedef struct stepreader_shm_header {
+	char magic[8];            // STEPREADER_SHM_MAGIC, not NUL-terminated
+	uint32_t version;         // STEPREADER_SHM_VERSION
+	uint32_t header_size;     // sizeof(stepreader_shm_header)
+	uint64_t size;            // of the whole segment
+	uint64_t vertex_count;
+	uint64_t triangle_count;
+	uint64_t face_count;
+	uint64_t vertices;        // offset of vertex_count*3 doubles
+	uint64_t indices;         // offset of triangle_count*3 uint32_t
+	uint64_t faces;           // offset of face_count*3 uint64_t (first, count, solid)
+} stepreader_shm_header;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
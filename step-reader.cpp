@@ -0,0 +1,362 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <istream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <Standard_Version.hxx>
+#include <STEPControl_Reader.hxx>
+#include <BRepMesh_IncrementalMesh.hxx>
+#include <BRepTools.hxx>
+#include <BRep_Builder.hxx>
+#include <TopExp_Explorer.hxx>
+#include <TopoDS_Shape.hxx>
+#include <TopoDS_Face.hxx>
+#include <TopoDS_Compound.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+#include "tessellation.h"
+#include "mesh-budget.h"
+#include "explore-shape.h"
+#include "step-index.h"
+#include "mapped-file.h"
+#include "compressed-input.h"
+#include "step-reader.h"
+#include "parallel.h"
+
+using namespace std;
+
+/* mesh_to_budget() accepts counts between this fraction of the budget and
+   the budget, or stops after MAX_BUDGET_PASSES meshing passes */
+#define BUDGET_SLACK 0.9
+#define MAX_BUDGET_PASSES 4
+
+#if OCC_VERSION_HEX < 0x070500
+/* Before OpenCASCADE 7.5 the reader has no ReadStream(): decompress the
+   file into a new temporary file (in $TMPDIR) for ReadFile().
+   Returns its name, or an empty string (after printing an error) on failure. */
+static std::string decompress_to_temp_file(const Mapped_file& file, Compression compression,
+					   const std::string& filename)
+{
+#ifdef _WIN32
+	const char* dir = getenv("TEMP");
+	std::string path = std::string(dir && *dir ? dir : ".") + "\\stepXXXXXX";
+	const int fd = (_mktemp_s(&path[0], path.size() + 1) == 0)
+		? _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE)
+		: -1;
+#else
+	const char* dir = getenv("TMPDIR");
+	std::string path = std::string(dir && *dir ? dir : "/tmp") + "/openscad-step-reader.XXXXXX";
+	const int fd = mkstemp(&path[0]);
+#endif
+	if (fd == -1) {
+		cerr << "Failed to create a temporary file for '" << filename << "': "
+		     << strerror(errno) << endl;
+		return std::string();
+	}
+
+	Decompressing_streambuf buf(file.data(), file.size(), compression);
+	istream in(&buf);
+	std::vector<char> chunk(1 << 20);
+	bool ok = true;
+	while (ok && in) {
+		in.read(&chunk[0], chunk.size());
+		const char* p = &chunk[0];
+		size_t left = (size_t)in.gcount();
+		while (ok && left > 0) {
+#ifdef _WIN32
+			const int n = _write(fd, p, (unsigned int)left);
+#else
+			const ssize_t n = ::write(fd, p, left);
+#endif
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0) {
+				cerr << "Failed to write temporary file '" << path << "': "
+				     << strerror(errno) << endl;
+				ok = false;
+				break;
+			}
+			p += n;
+			left -= n;
+		}
+	}
+#ifdef _WIN32
+	_close(fd);
+#else
+	::close(fd);
+#endif
+
+	if (ok && buf.failed()) {
+		cerr << "Failed to decompress '" << filename << "' (corrupted or truncated "
+		     << compression_name(compression) << " data)" << endl;
+		ok = false;
+	}
+	if (!ok) {
+		remove(path.c_str());
+		return std::string();
+	}
+	return path;
+}
+#endif
+
+/* Load the STEP file into the reader. gzip/zstd-compressed files are detected
+   by their magic bytes and decompressed on the fly while OpenCASCADE reads them. */
+static IFSelect_ReturnStatus read_step_file(STEPControl_Reader& reader, const std::string& filename)
+{
+	Mapped_file file;
+	if (!file.open(filename))
+		return IFSelect_RetError;
+
+	const Compression compression = detect_compression(file.data(), file.size());
+	if (compression == COMPRESSION_NONE) {
+		file.close();
+		return reader.ReadFile(filename.c_str());
+	}
+
+	if (!compression_supported(compression)) {
+		cerr << "Input file '" << filename << "' is " << compression_name(compression)
+		     << "-compressed, which is not supported by this build" << endl;
+		return IFSelect_RetError;
+	}
+
+#if OCC_VERSION_HEX >= 0x070500
+	Decompressing_streambuf buf(file.data(), file.size(), compression);
+	istream in(&buf);
+	IFSelect_ReturnStatus s = reader.ReadStream(filename.c_str(), in);
+	if (buf.failed()) {
+		cerr << "Failed to decompress '" << filename << "' (corrupted or truncated "
+		     << compression_name(compression) << " data)" << endl;
+		return IFSelect_RetFail;
+	}
+	return s;
+#else
+	const std::string temp = decompress_to_temp_file(file, compression, filename);
+	file.close();
+	if (temp.empty())
+		return IFSelect_RetFail;
+	IFSelect_ReturnStatus s = reader.ReadFile(temp.c_str());
+	remove(temp.c_str());
+	return s;
+#endif
+}
+
+Step_reader::Step_reader(const Step_reader_options& opts) :
+	_opts(opts), _meshed(false), _tolerance(0)
+{
+}
+
+Step_reader::Step_reader(const Step_reader_options& opts, const TopoDS_Shape& shape) :
+	_opts(opts), _shape(shape), _meshed(false), _tolerance(0)
+{
+}
+
+bool Step_reader::load(const std::string& filename)
+{
+	_shape.Nullify();
+	_meshed = false;
+
+	/* Reject malformed files before the (single-threaded) OpenCASCADE reader */
+	if (_opts.pre_parse && !validate_step_file(filename, _opts.threads))
+		return false;
+
+	/* See https://github.com/miho/OCC-CSG/blob/master/src/occ-csg.cpp#L311
+	   and https://github.com/lvk88/OccTutorial/blob/master/OtherExamples/runners/convertStepToStl.cpp */
+	STEPControl_Reader reader;
+	if (read_step_file(reader, filename) != IFSelect_RetDone) {
+		cerr << "Failed to load STEP file '" << filename << "'" << endl;
+		return false;
+	}
+	reader.TransferRoots();
+	_shape = reader.OneShape();
+	return true;
+}
+
+void Step_reader::mesh(double linear_tolerance)
+{
+	// BRepMesh keeps an existing triangulation if it is fine enough
+	if (_meshed && linear_tolerance > _tolerance)
+		BRepTools::Clean(_shape);
+
+	BRepMesh_IncrementalMesh mesh(_shape, linear_tolerance);
+	mesh.Perform();
+	_meshed = true;
+	_tolerance = linear_tolerance;
+}
+
+double Step_reader::mesh_to_budget(size_t max_triangles)
+{
+	const double diagonal = shape_diagonal(_shape);
+	if (diagonal <= 0 || max_triangles == 0) {
+		mesh(0.5);
+		return _tolerance;
+	}
+
+	// Aim at the middle of the accepted range
+	const double target = max_triangles * (1 + BUDGET_SLACK) / 2;
+
+	// A cheap first pass, then predicted from the faces sampled by it
+	mesh(diagonal / 100);
+	size_t count = count_triangles(_shape);
+	double prev_tolerance = 0;
+	size_t prev_count = 0;
+	double best_under = 0;     // the finest tolerance within the budget
+
+	for (int pass=1; pass<MAX_BUDGET_PASSES; ++pass) {
+		if (count <= max_triangles && (best_under == 0 || _tolerance < best_under))
+			best_under = _tolerance;
+		if (count <= max_triangles && count >= max_triangles * BUDGET_SLACK)
+			break;
+
+		double next;
+		if (pass == 1) {
+			next = predict_tolerance(sample_faces(_shape), _tolerance, (size_t)target);
+		}
+		else {
+			// Correct with the exponent measured over the last two passes
+			const double e = log((double)count / prev_count) / log(prev_tolerance / _tolerance);
+			if (!(e > 0.05))
+				break;  // the count hardly depends on the tolerance (e.g. only planes)
+			next = _tolerance * pow(count / target, 1 / e);
+		}
+		next = min(next, diagonal);
+		if (!(next > 0) || fabs(next / _tolerance - 1) < 0.01)
+			break;
+
+		prev_tolerance = _tolerance;
+		prev_count = count;
+		mesh(next);
+		count = count_triangles(_shape);
+	}
+
+	/* Stopped over the budget (out of passes, or the corrections stalled):
+	   go back to the finest tolerance which was within it, or to the
+	   coarsest one if none was */
+	if (count > max_triangles) {
+		if (best_under > 0)
+			mesh(best_under);
+		else if (_tolerance < diagonal)
+			mesh(diagonal);
+	}
+
+	return _tolerance;
+}
+
+double Step_reader::diagonal() const
+{
+	return shape_diagonal(_shape);
+}
+
+Face_vector Step_reader::faces(double min_edge, Cleanup_stats* stats) const
+{
+	return tessellate_shape(_shape, min_edge, stats);
+}
+
+Indexed_mesh Step_reader::indexed_mesh(bool weld_faces) const
+{
+	if (!weld_faces)
+		return build_indexed_mesh(faces(), false);
+	return tessellate_shape_indexed(_shape);
+}
+
+void Step_reader::explore() const
+{
+	explore_shape(_shape);
+}
+
+std::vector<Step_reader> Step_reader::split_solids() const
+{
+	std::vector<Step_reader> parts;
+	for (TopExp_Explorer SolidExp(_shape, TopAbs_SOLID); SolidExp.More(); SolidExp.Next())
+		parts.push_back(Step_reader(_opts, SolidExp.Current()));
+
+	TopoDS_Compound rest;
+	BRep_Builder builder;
+	builder.MakeCompound(rest);
+	bool any = false;
+	for (TopExp_Explorer FaceExp(_shape, TopAbs_FACE, TopAbs_SOLID); FaceExp.More(); FaceExp.Next()) {
+		builder.Add(rest, FaceExp.Current());
+		any = true;
+	}
+	if (any)
+		parts.push_back(Step_reader(_opts, rest));
+
+	return parts;
+}
+
+/* Parts which can not be meshed at the same time: union-find over the
+   parts, merged when they share the (location-independent) TShape of
+   an edge or a face */
+static std::vector< std::vector<size_t> > mesh_groups(const std::vector<Step_reader>& parts)
+{
+	std::vector<size_t> parent(parts.size());
+	for (size_t i=0;i<parts.size();++i)
+		parent[i] = i;
+	auto find = [&](size_t a) {
+		while (parent[a] != a)
+			a = parent[a] = parent[parent[a]];
+		return a;
+	};
+
+	std::unordered_map<const void*, size_t> owner;
+	for (size_t i=0;i<parts.size();++i) {
+		for (TopExp_Explorer Exp(parts[i].shape(), TopAbs_EDGE); Exp.More(); Exp.Next()) {
+			auto ins = owner.insert(make_pair((const void*)Exp.Current().TShape().get(), i));
+			if (!ins.second)
+				parent[find(i)] = find(ins.first->second);
+		}
+		for (TopExp_Explorer Exp(parts[i].shape(), TopAbs_FACE); Exp.More(); Exp.Next()) {
+			auto ins = owner.insert(make_pair((const void*)Exp.Current().TShape().get(), i));
+			if (!ins.second)
+				parent[find(i)] = find(ins.first->second);
+		}
+	}
+
+	std::vector< std::vector<size_t> > groups;
+	std::vector<size_t> group_of(parts.size(), (size_t)-1);
+	for (size_t i=0;i<parts.size();++i) {
+		size_t &g = group_of[find(i)];
+		if (g == (size_t)-1) {
+			g = groups.size();
+			groups.push_back(std::vector<size_t>());
+		}
+		groups[g].push_back(i);
+	}
+	return groups;
+}
+
+void mesh_parts(std::vector<Step_reader>& parts, double linear_tolerance, unsigned threads)
+{
+	const std::vector< std::vector<size_t> > groups = mesh_groups(parts);
+	parallel_for(groups.size(), threads ? threads : hardware_threads(), [&](size_t g) {
+		for (auto i : groups[g])
+			parts[i].mesh(linear_tolerance);
+	});
+}
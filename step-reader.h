@@ -0,0 +1,119 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __STEP_READER__
+#define __STEP_READER__
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <gp_Pnt.hxx>
+#include <TopoDS_Shape.hxx>
+#include <TopoDS_Face.hxx>
+
+#include "triangle.h"
+#include "indexed-mesh.h"
+#include "tessellation.h"
+
+/* libstepreader: load a STEP file, mesh it, and get its triangles.
+
+   Typical use (errors are printed to STDERR):
+
+	Step_reader reader;
+	if (!reader.load("part.stp"))
+		return 1;
+	reader.mesh(0.1);
+	Indexed_mesh mesh = reader.indexed_mesh();
+
+   mesh.vertices and mesh.indices are contiguous buffers (three doubles per
+   vertex, three uint32 indices per triangle), and mesh.faces holds the
+   triangle range of every STEP face. */
+
+struct Step_reader_options {
+	unsigned threads;      // 0 = use all available cores
+	bool pre_parse;        // validate the STEP text first (see validate_step_file)
+
+	Step_reader_options() : threads(0), pre_parse(false) {};
+};
+
+class Step_reader {
+	Step_reader_options _opts;
+	TopoDS_Shape _shape;
+	bool _meshed;
+	double _tolerance;
+
+	Step_reader(const Step_reader_options& opts, const TopoDS_Shape& shape);
+
+public:
+	explicit Step_reader(const Step_reader_options& opts = Step_reader_options());
+
+	/* Read and transfer the STEP file (gzip/zstd-compressed files are
+	   decompressed on the fly). Returns false (and prints an error to
+	   STDERR) on failure. */
+	bool load(const std::string& filename);
+
+	/* Triangulate the faces, 'linear_tolerance' is the maximum distance
+	   between the triangles and the surfaces (in model units).
+	   Calling it again re-meshes the faces: with a smaller tolerance,
+	   the faces which are already fine enough are kept, the others are
+	   meshed anew; with a larger tolerance, the triangulation is
+	   removed first. */
+	void mesh(double linear_tolerance);
+
+	/* Mesh with a tolerance which gives close to, and not more than,
+	   'max_triangles' triangles (unless even a tolerance of the size of
+	   the part gives more), in a few meshing passes: a coarse pass
+	   samples the faces, the tolerance is predicted from their surface
+	   types (see sample_faces), then corrected from the actual counts.
+	   If the last pass is over the budget, the finest tolerance which
+	   was within it is used again. Returns the tolerance used. */
+	double mesh_to_budget(size_t max_triangles);
+
+	/* Diagonal of the bounding box of the shape, e.g. for tolerances
+	   relative to the size of the part */
+	double diagonal() const;
+
+	/* The tolerance of the last mesh() */
+	double tolerance() const { return _tolerance; };
+
+	bool loaded() const { return !_shape.IsNull(); };
+	bool meshed() const { return _meshed; };
+	const TopoDS_Shape& shape() const { return _shape; };
+
+	/* The triangles of every face, in STEP order (see tessellate_shape,
+	   also for the cleanup with min_edge > 0). Requires mesh(). */
+	Face_vector faces(double min_edge = 0, Cleanup_stats* stats = NULL) const;
+
+	/* Same, as shared vertices + indices: the faces share the vertices
+	   on their common edges (see tessellate_shape_indexed). With
+	   weld_faces=false, every face has its own vertices. */
+	Indexed_mesh indexed_mesh(bool weld_faces = true) const;
+
+	/* Print the shape hierarchy to STDOUT (see explore_shape) */
+	void explore() const;
+
+	/* Every solid of the shape in a reader of its own (the faces which are
+	   not part of any solid are one more part), e.g. to mesh and convert
+	   the solids of an assembly separately (see mesh_parts). */
+	std::vector<Step_reader> split_solids() const;
+};
+
+/* Mesh the parts (see Step_reader::split_solids) on up to 'threads'
+   threads (0 = all available cores). Parts which share edges or faces,
+   e.g. instances of the same solid (which share its triangulation),
+   are meshed one after the other on the same thread. */
+void mesh_parts(std::vector<Step_reader>& parts, double linear_tolerance,
+		unsigned threads = 0);
+
+#endif
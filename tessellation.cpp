@@ -11,6 +11,10 @@
  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
  * GNU Lesser General Public License for more details.
  */
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
 #include <BRepPrimAPI_MakeCylinder.hxx>
 #include <BRepPrimAPI_MakeCone.hxx>
 #include <BRepPrimAPI_MakeBox.hxx>
@@ -37,9 +41,11 @@
 #include <BRepMesh_IncrementalMesh.hxx>
 #include <RWStl.hxx>
 #include <Poly_Triangulation.hxx>
+#include <Poly_PolygonOnTriangulation.hxx>
 #include <OSD_Path.hxx>
 #include <TopoDS_Compound.hxx>
 #include <TopoDS_Vertex.hxx>
+#include <TopoDS_Edge.hxx>
 #include <TopoDS_Wire.hxx>
 #include <TopoDS_Face.hxx>
 #include <Bnd_Box.hxx>
@@ -51,11 +57,14 @@
 #include <BRepBuilderAPI_MakeWire.hxx>
 #include <gp_Circ.hxx>
 #include <TopExp_Explorer.hxx>
+#include <TopTools_IndexedMapOfShape.hxx>
+#include <TopTools_IndexedDataMapOfShapeListOfShape.hxx>
 #include <Font_BRepFont.hxx>
 #include <Font_BRepTextBuilder.hxx>
 #include <BRepBuilderAPI_GTransform.hxx>
 #include <BRepBuilderAPI_Transform.hxx>
 #include <gp_GTrsf.hxx>
+#include <gp_Trsf.hxx>
 #include <BRepFilletAPI_MakeFillet.hxx>
 #include <BRepFilletAPI_MakeChamfer.hxx>
 #include <TColgp_HArray1OfPnt.hxx>
@@ -64,11 +73,317 @@
 
 
 #include "triangle.h"
+#include "indexed-mesh.h"
 #include "tessellation.h"
 
-Face tessellate_face(const TopoDS_Face& aFace)
+/* Copy the nodes of a triangulation into separate x/y/z arrays */
+static void gather_nodes(const Handle(Poly_Triangulation)& aTr,
+                         std::vector<double>& xs, std::vector<double>& ys,
+                         std::vector<double>& zs)
+{
+    const int nbNodes = aTr->NbNodes();
+    xs.resize(nbNodes);
+    ys.resize(nbNodes);
+    zs.resize(nbNodes);
+    for (int i = 0; i < nbNodes; i++)
+    {
+        const gp_Pnt p = aTr->Node(i + 1);
+        xs[i] = p.X();
+        ys[i] = p.Y();
+        zs[i] = p.Z();
+    }
+}
+
+/* Apply a location's transformation to all the gathered nodes in one
+   pass: the 3x4 matrix is applied in a simple loop which the compiler
+   can vectorize. */
+static void transform_nodes(const gp_Trsf& trsf, std::vector<double>& xs,
+                            std::vector<double>& ys, std::vector<double>& zs)
 {
-    Face output_face;
+    // Value() includes the scale factor
+    double m[3][4];
+    for (int r = 0; r < 3; r++)
+        for (int c = 0; c < 4; c++)
+            m[r][c] = trsf.Value(r + 1, c + 1);
+
+    const int nbNodes = (int)xs.size();
+    double* x = &xs[0];
+    double* y = &ys[0];
+    double* z = &zs[0];
+    for (int i = 0; i < nbNodes; i++)
+    {
+        const double px = x[i], py = y[i], pz = z[i];
+        x[i] = m[0][0] * px + m[0][1] * py + m[0][2] * pz + m[0][3];
+        y[i] = m[1][0] * px + m[1][1] * py + m[1][2] * pz + m[1][3];
+        z[i] = m[2][0] * px + m[2][1] * py + m[2][2] * pz + m[2][3];
+    }
+}
+
+/* Add the triangles of a triangulation to the face.
+   node(n) returns the (1-based) node n as a Point. */
+template<class Node_fn>
+static void add_triangles(Face& face, const Handle(Poly_Triangulation)& aTr,
+                          bool reversed, Node_fn node)
+{
+    const int nbTriangles = aTr->NbTriangles();
+    face.reserve(nbTriangles);
+
+    for (Standard_Integer nt = 1; nt <= nbTriangles; nt++)
+    {
+        int n1, n2, n3;
+        aTr->Triangle(nt).Get(n1, n2, n3);
+
+        if (reversed)
+        {
+            int tmp = n1;
+            n1 = n3;
+            n3 = tmp;
+        }
+
+        face.addTriangle(Triangle(node(n1), node(n2), node(n3)));
+    }
+}
+
+/* How far a node may move when short edges are collapsed: interior nodes
+   anywhere, nodes inside an edge's polygon only along the boundary, and
+   the other boundary nodes (the vertices) not at all. */
+enum Node_kind { NODE_INTERIOR, NODE_EDGE, NODE_FIXED };
+
+/* Nodes merged by collapsing short edges. Every group keeps its strongest
+   node (by Node_kind, then the lowest point by x, y, z). Boundary nodes are
+   only merged with each other along a boundary edge: the face on the other
+   side of the edge sees the same short edge and keeps the same node, while
+   the interior nodes of either face never move a boundary node. */
+class Node_groups {
+    const std::vector<double> &_xs, &_ys, &_zs;
+    const std::vector<unsigned char> &_kind;
+    std::vector<int> _parent;
+
+    bool stronger(int a, int b) const
+    {
+        if (_kind[a] != _kind[b])
+            return _kind[a] > _kind[b];
+        if (_xs[a] != _xs[b])
+            return _xs[a] < _xs[b];
+        if (_ys[a] != _ys[b])
+            return _ys[a] < _ys[b];
+        return _zs[a] < _zs[b];
+    }
+
+public:
+    Node_groups(const std::vector<double>& xs, const std::vector<double>& ys,
+                const std::vector<double>& zs, const std::vector<unsigned char>& kind) :
+        _xs(xs), _ys(ys), _zs(zs), _kind(kind), _parent(xs.size())
+    {
+        for (size_t i = 0; i < _parent.size(); i++)
+            _parent[i] = (int)i;
+    }
+
+    int find(int a)
+    {
+        while (_parent[a] != a)
+            a = _parent[a] = _parent[_parent[a]];
+        return a;
+    }
+
+    // Returns false if they were already merged, or may not be
+    bool merge(int a, int b, bool boundary_edge)
+    {
+        a = find(a);
+        b = find(b);
+        if (a == b)
+            return false;
+        if (_kind[a] != NODE_INTERIOR && _kind[b] != NODE_INTERIOR
+            && (!boundary_edge || (_kind[a] == NODE_FIXED && _kind[b] == NODE_FIXED)))
+            return false;
+        if (stronger(b, a))
+            std::swap(a, b);
+        _parent[b] = a;
+        return true;
+    }
+};
+
+static uint64_t edge_key(int a, int b)
+{
+    return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+}
+
+/* Clean up a triangulation (0-based node indices, three per triangle)
+   without opening it: edges shorter than 'min_edge' are collapsed (see
+   Node_groups, 'edge_inner' marks the nodes inside the edges' polygons),
+   and the triangles left with a repeated node are dropped. Triangles which
+   are still thinner than 'min_edge' (caps) get their longest edge flipped
+   with the neighbouring triangle. The per-triangle tests run over plain
+   arrays, so they vectorize, and the rare fixes are made afterwards. */
+static void clean_triangles(const std::vector<double>& xs, const std::vector<double>& ys,
+                            const std::vector<double>& zs, const std::vector<unsigned char>& edge_inner,
+                            std::vector<int>& tris, double min_edge, Cleanup_stats& stats)
+{
+    size_t nbTriangles = tris.size() / 3;
+    const double min2 = min_edge * min_edge;
+    int* t = tris.empty() ? NULL : &tris[0];
+    const double* x = xs.empty() ? NULL : &xs[0];
+    const double* y = ys.empty() ? NULL : &ys[0];
+    const double* z = zs.empty() ? NULL : &zs[0];
+
+    // Pass 1: which triangles have a short edge
+    std::vector<unsigned char> short_edge(nbTriangles);
+    size_t any_short = 0;
+    for (size_t i = 0; i < nbTriangles; i++)
+    {
+        const int a = t[3 * i], b = t[3 * i + 1], c = t[3 * i + 2];
+        const double ab = (x[a] - x[b]) * (x[a] - x[b]) + (y[a] - y[b]) * (y[a] - y[b])
+            + (z[a] - z[b]) * (z[a] - z[b]);
+        const double bc = (x[b] - x[c]) * (x[b] - x[c]) + (y[b] - y[c]) * (y[b] - y[c])
+            + (z[b] - z[c]) * (z[b] - z[c]);
+        const double ca = (x[c] - x[a]) * (x[c] - x[a]) + (y[c] - y[a]) * (y[c] - y[a])
+            + (z[c] - z[a]) * (z[c] - z[a]);
+        const unsigned char s = (ab < min2) | ((bc < min2) << 1) | ((ca < min2) << 2);
+        short_edge[i] = s;
+        any_short += (s != 0);
+    }
+
+    // Collapse the short edges, and use the kept node in every triangle
+    if (any_short)
+    {
+        // Boundary edges: used by a single triangle of the face
+        std::unordered_map<uint64_t, int> uses;
+        uses.reserve(nbTriangles * 2);
+        for (size_t i = 0; i < 3 * nbTriangles; i++)
+        {
+            const int a = t[i], b = t[i - i % 3 + (i + 1) % 3];
+            uses[edge_key(std::min(a, b), std::max(a, b))]++;
+        }
+        std::vector<unsigned char> kind(xs.size(), NODE_INTERIOR);
+        for (auto &u : uses)
+        {
+            if (u.second != 1)
+                continue;
+            const int a = (int)(u.first >> 32), b = (int)(uint32_t)u.first;
+            kind[a] = edge_inner[a] ? NODE_EDGE : NODE_FIXED;
+            kind[b] = edge_inner[b] ? NODE_EDGE : NODE_FIXED;
+        }
+
+        Node_groups groups(xs, ys, zs, kind);
+        for (size_t i = 0; i < nbTriangles; i++)
+        {
+            const unsigned char s = short_edge[i];
+            for (int e = 0; e < 3; e++)
+            {
+                if (!(s & (1 << e)))
+                    continue;
+                const int a = t[3 * i + e], b = t[3 * i + (e + 1) % 3];
+                if (groups.merge(a, b, uses[edge_key(std::min(a, b), std::max(a, b))] == 1))
+                    stats.short_edges++;
+            }
+        }
+        for (size_t i = 0; i < tris.size(); i++)
+            tris[i] = groups.find(tris[i]);
+
+        size_t n = 0;
+        for (size_t i = 0; i < nbTriangles; i++)
+        {
+            if (t[3 * i] == t[3 * i + 1] || t[3 * i + 1] == t[3 * i + 2] || t[3 * i] == t[3 * i + 2])
+                continue;
+            t[3 * n] = t[3 * i];
+            t[3 * n + 1] = t[3 * i + 1];
+            t[3 * n + 2] = t[3 * i + 2];
+            n++;
+        }
+        stats.degenerate += nbTriangles - n;
+        nbTriangles = n;
+        tris.resize(3 * n);
+        t = tris.empty() ? NULL : &tris[0];
+    }
+
+    // Pass 2: triangles thinner than min_edge (height below the longest
+    // edge): |ab x ac| < min_edge * longest edge. Remember the longest edge.
+    std::vector<unsigned char> thin(nbTriangles);
+    size_t any_thin = 0;
+    for (size_t i = 0; i < nbTriangles; i++)
+    {
+        const int a = t[3 * i], b = t[3 * i + 1], c = t[3 * i + 2];
+        const double ux = x[b] - x[a], uy = y[b] - y[a], uz = z[b] - z[a];
+        const double vx = x[c] - x[a], vy = y[c] - y[a], vz = z[c] - z[a];
+        const double wx = x[c] - x[b], wy = y[c] - y[b], wz = z[c] - z[b];
+        const double nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+        const double cross2 = nx * nx + ny * ny + nz * nz;
+        const double ab = ux * ux + uy * uy + uz * uz;
+        const double ca = vx * vx + vy * vy + vz * vz;
+        const double bc = wx * wx + wy * wy + wz * wz;
+        const double longest2 = std::max(std::max(ab, ca), bc);
+        // 1 + the index of the longest edge (0 = ab, 1 = bc, 2 = ca), or 0
+        const unsigned char e = (ab >= bc && ab >= ca) ? 1 : (bc >= ca ? 2 : 3);
+        thin[i] = (cross2 <= min2 * longest2) ? e : 0;
+        any_thin += (thin[i] != 0);
+    }
+    if (!any_thin)
+        return;
+
+    // Flip the longest edge of the thin triangles (boundary edges stay)
+    std::unordered_map<uint64_t, size_t> half_edges;
+    half_edges.reserve(nbTriangles * 3);
+    for (size_t i = 0; i < nbTriangles; i++)
+        for (int e = 0; e < 3; e++)
+            half_edges[edge_key(t[3 * i + e], t[3 * i + (e + 1) % 3])] = i;
+
+    auto normal = [&](int a, int b, int c, double* n) {
+        const double ux = x[b] - x[a], uy = y[b] - y[a], uz = z[b] - z[a];
+        const double vx = x[c] - x[a], vy = y[c] - y[a], vz = z[c] - z[a];
+        n[0] = uy * vz - uz * vy;
+        n[1] = uz * vx - ux * vz;
+        n[2] = ux * vy - uy * vx;
+    };
+
+    std::vector<unsigned char> changed(nbTriangles);
+    for (size_t i = 0; i < nbTriangles; i++)
+    {
+        if (!thin[i] || changed[i])
+            continue;
+        const int e = thin[i] - 1;
+        const int a = t[3 * i + e], b = t[3 * i + (e + 1) % 3], c = t[3 * i + (e + 2) % 3];
+
+        auto it = half_edges.find(edge_key(b, a));
+        if (it == half_edges.end() || changed[it->second])
+            continue;
+        const size_t j = it->second;
+        int d = -1;
+        for (int k = 0; k < 3; k++)
+            if (t[3 * j + k] != a && t[3 * j + k] != b)
+                d = t[3 * j + k];
+        if (d < 0 || d == c || half_edges.count(edge_key(c, d)) || half_edges.count(edge_key(d, c)))
+            continue;
+
+        // (a,b,c) + (b,a,d) -> (a,d,c) + (d,b,c), if neither new triangle folds over
+        double n1[3], n2[3], m1[3], m2[3];
+        normal(a, b, c, n1);
+        normal(b, a, d, n2);
+        normal(a, d, c, m1);
+        normal(d, b, c, m2);
+        const double n[3] = { n1[0] + n2[0], n1[1] + n2[1], n1[2] + n2[2] };
+        if (m1[0] * n[0] + m1[1] * n[1] + m1[2] * n[2] <= 0
+            || m2[0] * n[0] + m2[1] * n[1] + m2[2] * n[2] <= 0)
+            continue;
+
+        t[3 * i] = a; t[3 * i + 1] = d; t[3 * i + 2] = c;
+        t[3 * j] = d; t[3 * j + 1] = b; t[3 * j + 2] = c;
+        half_edges.erase(edge_key(a, b));
+        half_edges.erase(edge_key(b, a));
+        half_edges[edge_key(a, d)] = i;
+        half_edges[edge_key(d, c)] = i;
+        half_edges[edge_key(b, c)] = j;
+        half_edges[edge_key(c, d)] = j;
+        changed[i] = changed[j] = 1;
+        stats.flipped++;
+    }
+}
+
+Face tessellate_face(const TopoDS_Face& aFace, const Point& origin,
+                     const std::shared_ptr<Triangle_arena>& arena,
+                     double min_edge, Cleanup_stats* stats)
+{
+    Face output_face = arena ? Face(arena) : Face();
+    output_face.set_origin(origin);
 
     /* This code is based on
        https://www.opencascade.com/content/how-get-triangles-vertices-data-absolute-coords-native-opengl-rendering
@@ -81,42 +396,64 @@ Face tessellate_face(const TopoDS_Face& aFace)
 
     if (!aTr.IsNull())
     {
-        // For newer versions of OpenCASCADE, we need to work with nodes directly
-        int nbNodes = aTr->NbNodes();
-        int nbTriangles = aTr->NbTriangles();
+        const bool reversed = (faceOrientation != TopAbs_Orientation::TopAbs_FORWARD);
 
-        // Create an array to store transformed nodes
-        TColgp_Array1OfPnt aPoints(1, nbNodes);
-
-        // Get all nodes and transform them
-        for (Standard_Integer i = 1; i <= nbNodes; i++)
+        if (min_edge > 0)
         {
-            gp_Pnt p = aTr->Node(i);  // Use Node(i) instead of Nodes()
-            aPoints(i) = p.Transformed(aLocation);
-        }
+            std::vector<double> xs, ys, zs;
+            gather_nodes(aTr, xs, ys, zs);
+            if (!aLocation.IsIdentity())
+                transform_nodes(aLocation.Transformation(), xs, ys, zs);
 
-        // Process all triangles
-        for (Standard_Integer nt = 1; nt <= nbTriangles; nt++)
-        {
-            // Use Triangle(nt) to get triangle indices
-            Poly_Triangle triangle = aTr->Triangle(nt);
-
-            int n1, n2, n3;
-            triangle.Get(n1, n2, n3);
+            const int nbTriangles = aTr->NbTriangles();
+            std::vector<int> tris(3 * nbTriangles);
+            for (int nt = 0; nt < nbTriangles; nt++)
+            {
+                int n1, n2, n3;
+                aTr->Triangle(nt + 1).Get(n1, n2, n3);
+                tris[3 * nt] = (reversed ? n3 : n1) - 1;
+                tris[3 * nt + 1] = n2 - 1;
+                tris[3 * nt + 2] = (reversed ? n1 : n3) - 1;
+            }
 
-            if (faceOrientation != TopAbs_Orientation::TopAbs_FORWARD)
+            // The nodes inside the edges' polygons may move along their edge
+            std::vector<unsigned char> edge_inner(xs.size(), 0);
+            for (TopExp_Explorer EdgeExp(aFace, TopAbs_EDGE); EdgeExp.More(); EdgeExp.Next())
             {
-                int tmp = n1;
-                n1 = n3;
-                n3 = tmp;
+                Handle(Poly_PolygonOnTriangulation) aPoly =
+                    BRep_Tool::PolygonOnTriangulation(TopoDS::Edge(EdgeExp.Current()), aTr, aLocation);
+                if (aPoly.IsNull())
+                    continue;
+                const TColStd_Array1OfInteger& nodes = aPoly->Nodes();
+                for (int i = nodes.Lower() + 1; i < nodes.Upper(); i++)
+                    edge_inner[nodes(i) - 1] = 1;
             }
 
-            gp_Pnt aPnt1 = aPoints(n1);
-            gp_Pnt aPnt2 = aPoints(n2);
-            gp_Pnt aPnt3 = aPoints(n3);
+            Cleanup_stats local;
+            clean_triangles(xs, ys, zs, edge_inner, tris, min_edge, stats ? *stats : local);
 
-            const Triangle tr(aPnt1, aPnt2, aPnt3);
-            output_face.addTriangle(tr);
+            output_face.reserve(tris.size() / 3);
+            for (size_t i = 0; i < tris.size(); i += 3)
+            {
+                const int a = tris[i], b = tris[i + 1], c = tris[i + 2];
+                output_face.addTriangle(Triangle(Point(xs[a], ys[a], zs[a]),
+                                                 Point(xs[b], ys[b], zs[b]),
+                                                 Point(xs[c], ys[c], zs[c])));
+            }
+        }
+        else if (aLocation.IsIdentity())
+        {
+            // The common case (no assembly transform): use the nodes as they are
+            add_triangles(output_face, aTr, reversed,
+                          [&](int n) { return Point(aTr->Node(n)); });
+        }
+        else
+        {
+            std::vector<double> xs, ys, zs;
+            gather_nodes(aTr, xs, ys, zs);
+            transform_nodes(aLocation.Transformation(), xs, ys, zs);
+            add_triangles(output_face, aTr, reversed,
+                          [&](int n) { return Point(xs[n - 1], ys[n - 1], zs[n - 1]); });
         }
     }
 
@@ -124,17 +461,201 @@ Face tessellate_face(const TopoDS_Face& aFace)
 }
 
 
-Face_vector tessellate_shape (const TopoDS_Shape& shape)
+/* Number the solids. Faces which are not part of any solid
+   get the number after the last solid. */
+class Solid_numbers {
+	TopTools_IndexedMapOfShape _solids;
+	TopTools_IndexedDataMapOfShapeListOfShape _face_solids;
+
+public:
+	Solid_numbers(const TopoDS_Shape& shape)
+		{
+			TopExp::MapShapes(shape, TopAbs_SOLID, _solids);
+			TopExp::MapShapesAndAncestors(shape, TopAbs_FACE, TopAbs_SOLID, _face_solids);
+		}
+
+	size_t solid(const TopoDS_Face& aFace) const
+		{
+			const int idx = _face_solids.FindIndex(aFace);
+			if (idx > 0 && !_face_solids.FindFromIndex(idx).IsEmpty())
+				return _solids.FindIndex(_face_solids.FindFromIndex(idx).First()) - 1;
+			return _solids.Extent();
+		}
+};
+
+Face_vector tessellate_shape (const TopoDS_Shape& shape, double min_edge, Cleanup_stats* stats)
 {
 	Face_vector output_faces;
+	const Solid_numbers solids(shape);
+
+	/* With FLOAT_MESH, points are stored relative to the center of the part */
+	Point origin;
+#ifdef FLOAT_MESH
+	Bnd_Box box;
+	BRepBndLib::Add(shape, box);
+	if (!box.IsVoid()) {
+		double xmin, ymin, zmin, xmax, ymax, zmax;
+		box.Get(xmin, ymin, zmin, xmax, ymax, zmax);
+		origin = Point((xmin + xmax) / 2, (ymin + ymax) / 2, (zmin + zmax) / 2);
+	}
+#endif
+
+	/* Allocate the triangles of all faces at once */
+	size_t total = 0, count = 0;
+	for (TopExp_Explorer FaceExp(shape, TopAbs_FACE); FaceExp.More(); FaceExp.Next())
+	{
+		TopLoc_Location loc;
+		Handle(Poly_Triangulation) tr = BRep_Tool::Triangulation(TopoDS::Face(FaceExp.Current()), loc);
+		if (!tr.IsNull())
+			total += tr->NbTriangles();
+		++count;
+	}
+	std::shared_ptr<Triangle_arena> arena(new Triangle_arena());
+	arena->reserve(total);
+	output_faces.reserve(count);
 
 	for (TopExp_Explorer FaceExp(shape, TopAbs_FACE); FaceExp.More(); FaceExp.Next())
 	{
 		const TopoDS_Face &aFace = TopoDS::Face(FaceExp.Current());
 
-		const Face &f = tessellate_face(aFace);
+		Face f = tessellate_face(aFace, origin, arena, min_edge, stats);
+		f.set_solid(solids.solid(aFace));
+
 		output_faces.push_back(f);
 	}
 
 	return output_faces;
 }
+
+Indexed_mesh tessellate_shape_indexed(const TopoDS_Shape& shape)
+{
+	Indexed_mesh mesh;
+	const Solid_numbers solids(shape);
+	const uint32_t NONE = UINT32_MAX;
+
+	/* The mesh vertex of every TopoDS vertex, and of every node of
+	   every edge's polygon (set by the first face on the edge) */
+	TopTools_IndexedMapOfShape vertices, edges;
+	TopExp::MapShapes(shape, TopAbs_VERTEX, vertices);
+	TopExp::MapShapes(shape, TopAbs_EDGE, edges);
+	std::vector<uint32_t> vertex_ids(vertices.Extent(), NONE);
+	std::vector< std::vector<uint32_t> > edge_ids(edges.Extent());
+
+	size_t total = 0, nodes = 0, count = 0;
+	for (TopExp_Explorer FaceExp(shape, TopAbs_FACE); FaceExp.More(); FaceExp.Next())
+	{
+		TopLoc_Location loc;
+		Handle(Poly_Triangulation) tr = BRep_Tool::Triangulation(TopoDS::Face(FaceExp.Current()), loc);
+		if (!tr.IsNull()) {
+			total += tr->NbTriangles();
+			nodes += tr->NbNodes();
+		}
+		++count;
+	}
+	mesh.indices.reserve(total * 3);
+	mesh.vertices.reserve(nodes);
+	mesh.faces.reserve(count);
+
+	std::vector<double> xs, ys, zs;
+	std::vector<uint32_t> node_ids;   // mesh vertex of every node of the face
+	for (TopExp_Explorer FaceExp(shape, TopAbs_FACE); FaceExp.More(); FaceExp.Next())
+	{
+		const TopoDS_Face &aFace = TopoDS::Face(FaceExp.Current());
+		Mesh_face mf = { mesh.triangles(), 0, solids.solid(aFace) };
+
+		TopLoc_Location aLocation;
+		Handle(Poly_Triangulation) aTr = BRep_Tool::Triangulation(aFace, aLocation);
+		if (aTr.IsNull()) {
+			mesh.faces.push_back(mf);
+			continue;
+		}
+
+		gather_nodes(aTr, xs, ys, zs);
+		if (!aLocation.IsIdentity())
+			transform_nodes(aLocation.Transformation(), xs, ys, zs);
+		node_ids.assign(xs.size(), NONE);
+
+		auto add_vertex = [&](int n) {
+			mesh.vertices.push_back(Point(xs[n], ys[n], zs[n]));
+			return (uint32_t)(mesh.vertices.size() - 1);
+		};
+
+		/* The boundary nodes, shared with the other faces on every edge.
+		   (A seam edge is visited twice, once for each of its polygons
+		   on the triangulation.) */
+		for (TopExp_Explorer EdgeExp(aFace, TopAbs_EDGE); EdgeExp.More(); EdgeExp.Next())
+		{
+			const TopoDS_Edge &anEdge = TopoDS::Edge(EdgeExp.Current());
+			Handle(Poly_PolygonOnTriangulation) aPoly =
+				BRep_Tool::PolygonOnTriangulation(anEdge, aTr, aLocation);
+			if (aPoly.IsNull())
+				continue;
+
+			// Node indices along the edge, from its first vertex to its last
+			const TColStd_Array1OfInteger &poly_nodes = aPoly->Nodes();
+			const int lower = poly_nodes.Lower();
+			const int nbNodes = poly_nodes.Length();
+
+			std::vector<uint32_t> &ids = edge_ids[edges.FindIndex(anEdge) - 1];
+			if (ids.empty()) {
+				// All the nodes of a degenerated edge (e.g. the pole of a sphere) are the vertex
+				const bool degenerated = BRep_Tool::Degenerated(anEdge);
+				const TopoDS_Vertex first = TopExp::FirstVertex(anEdge);
+				const TopoDS_Vertex last = TopExp::LastVertex(anEdge);
+				ids.resize(nbNodes);
+				for (int i = 0; i < nbNodes; i++) {
+					const int n = poly_nodes(lower + i) - 1;
+					const TopoDS_Vertex *v = NULL;
+					if (i == 0 || degenerated)
+						v = &first;
+					else if (i == nbNodes - 1)
+						v = &last;
+					if (!v || v->IsNull()) {
+						ids[i] = add_vertex(n);
+						continue;
+					}
+					uint32_t &id = vertex_ids[vertices.FindIndex(*v) - 1];
+					if (id == NONE)
+						id = add_vertex(n);
+					ids[i] = id;
+				}
+			}
+			// Discretized differently on this face: not shared
+			if ((int)ids.size() != nbNodes)
+				continue;
+
+			for (int i = 0; i < nbNodes; i++) {
+				uint32_t &id = node_ids[poly_nodes(lower + i) - 1];
+				if (id == NONE)
+					id = ids[i];
+			}
+		}
+
+		// The inner nodes
+		for (size_t n = 0; n < node_ids.size(); n++)
+			if (node_ids[n] == NONE)
+				node_ids[n] = add_vertex((int)n);
+
+		const bool reversed = (aFace.Orientation() != TopAbs_Orientation::TopAbs_FORWARD);
+		const int nbTriangles = aTr->NbTriangles();
+		for (int nt = 1; nt <= nbTriangles; nt++)
+		{
+			int n1, n2, n3;
+			aTr->Triangle(nt).Get(n1, n2, n3);
+			if (reversed)
+				std::swap(n1, n3);
+
+			const uint32_t a = node_ids[n1 - 1], b = node_ids[n2 - 1], c = node_ids[n3 - 1];
+			// Collapsed onto a shared vertex (next to a degenerated edge)
+			if (a == b || b == c || a == c)
+				continue;
+			mesh.indices.push_back(a);
+			mesh.indices.push_back(b);
+			mesh.indices.push_back(c);
+		}
+		mf.count = mesh.triangles() - mf.first;
+		mesh.faces.push_back(mf);
+	}
+
+	return mesh;
+}
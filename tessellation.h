@@ -14,7 +14,30 @@
 #ifndef __TESSELLATION__
 #define __TESSELLATION__
 
-Face tessellate_face(const TopoDS_Face &aFace);
-Face_vector tessellate_shape (const TopoDS_Shape& shape);
+/* Triangles removed by the cleanup (min_edge > 0) */
+struct Cleanup_stats {
+	size_t degenerate;     // dropped: left with a repeated node by the collapse
+	size_t short_edges;    // edges shorter than min_edge, collapsed
+	size_t flipped;        // longest edges of triangles thinner than min_edge
+
+	Cleanup_stats() : degenerate(0), short_edges(0), flipped(0) {};
+};
+
+/* With 'arena', the triangles are appended to it (see Face).
+   With min_edge > 0, edges shorter than it are collapsed and the longest
+   edge of triangles thinner than it is flipped (counted in 'stats', if
+   given). Nodes on the face's boundary only move along it, so the faces
+   still fit together. */
+Face tessellate_face(const TopoDS_Face &aFace, const Point& origin = Point(),
+                     const std::shared_ptr<Triangle_arena>& arena = std::shared_ptr<Triangle_arena>(),
+                     double min_edge = 0, Cleanup_stats* stats = NULL);
+Face_vector tessellate_shape (const TopoDS_Shape& shape, double min_edge = 0,
+                              Cleanup_stats* stats = NULL);
+
+/* Extract the triangulation with shared vertices. The nodes on the edges
+   come from the edge polygons (BRep_Tool::PolygonOnTriangulation), so
+   adjacent faces use exactly the same vertices on their common edges:
+   the mesh of a closed shape is watertight without welding by position. */
+Indexed_mesh tessellate_shape_indexed(const TopoDS_Shape& shape);
 
 #endif
@@ -14,6 +14,41 @@
 #ifndef __TRIANGLE__
 #define __TRIANGLE__
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/* Write one coordinate. With std::fixed, trailing zeros are dropped
+   ("1.5" instead of "1.500000"), otherwise as usual for the stream. */
+static inline void write_coord(std::ostream &ostrm, double v)
+{
+	if (!(ostrm.flags() & std::ios_base::fixed)) {
+		ostrm << v;
+		return;
+	}
+
+	char buf[64];
+	int n = snprintf(buf, sizeof(buf), "%.*f", (int)ostrm.precision(), v);
+	if (n <= 0 || n >= (int)sizeof(buf)) {
+		ostrm << v;
+		return;
+	}
+	if (memchr(buf, '.', n)) {
+		while (buf[n-1] == '0')
+			--n;
+		if (buf[n-1] == '.')
+			--n;
+	}
+	if (n == 2 && buf[0] == '-' && buf[1] == '0') {
+		// "-0.0001" with 3 decimals
+		buf[0] = '0';
+		n = 1;
+	}
+	ostrm.write(buf, n);
+}
+
 class Point {
 	double _x,_y,_z;
 public:
@@ -26,13 +61,24 @@ public:
 
 	void write_ascii_stl(std::ostream &ostrm) const
 		{
-			ostrm << "vertex " << _x << " " << _y << " " << _z ;
+			ostrm << "vertex ";
+			write_coord(ostrm, _x);
+			ostrm << " ";
+			write_coord(ostrm, _y);
+			ostrm << " ";
+			write_coord(ostrm, _z);
 		}
 
 };
 static std::ostream & operator << (std::ostream &out, const Point &p)
 {
-	out << "[" << p.x() << "," << p.y() << "," << p.z() << "]";
+	out << "[";
+	write_coord(out, p.x());
+	out << ",";
+	write_coord(out, p.y());
+	out << ",";
+	write_coord(out, p.z());
+	out << "]";
 	return out;
 }
 
@@ -42,6 +88,17 @@ class Triangle {
 public:
 	Triangle() {} ;
 	Triangle(const Point& p1, const Point& p2, const Point& p3) : _p1(p1), _p2(p2), _p3(p3) {}
+	const Point& p1() const { return _p1; };
+	const Point& p2() const { return _p2; };
+	const Point& p3() const { return _p3; };
+
+	template<class Fn>
+	void for_each_point(Fn fn)
+		{
+			fn(_p1);
+			fn(_p2);
+			fn(_p3);
+		}
 
 	void write_points_vector(std::ostream &ostrm) const
 		{
@@ -67,25 +124,186 @@ public:
 
 
 
+#ifdef FLOAT_MESH
+/* A triangle stored in float32, relative to an origin (see Face::set_origin).
+   Half the size of Triangle - float precision is plenty once the points
+   are recentred to the part. */
+class Stored_triangle {
+	float _c[9];
+public:
+	Stored_triangle(const Triangle& t, const Point& o)
+		{
+			const Point* p[3] = { &t.p1(), &t.p2(), &t.p3() };
+			for (int i=0;i<3;++i) {
+				_c[i*3]   = (float)(p[i]->x() - o.x());
+				_c[i*3+1] = (float)(p[i]->y() - o.y());
+				_c[i*3+2] = (float)(p[i]->z() - o.z());
+			}
+		}
+
+	Triangle get(const Point& o) const
+		{
+			return Triangle(Point(o.x() + _c[0], o.y() + _c[1], o.z() + _c[2]),
+					Point(o.x() + _c[3], o.y() + _c[4], o.z() + _c[5]),
+					Point(o.x() + _c[6], o.y() + _c[7], o.z() + _c[8]));
+		}
+};
+#endif
+
+
+#ifndef FLOAT_MESH
+typedef Triangle Stored_triangle;
+#endif
+
+/* Storage for the triangles of many faces (see Face) */
+typedef std::vector<Stored_triangle> Triangle_arena;
+
+
+/* The triangles of one STEP face: a range of a Triangle_arena.
+   All the faces of a shape can share one arena, allocated once with room
+   for all of their triangles (see tessellate_shape). Appending to a face
+   which is not at the end of its arena moves it to a new arena.
+   Copies of a Face are views of the same triangles. */
 class Face {
-	std::vector<Triangle> triangles;
+	std::shared_ptr<Triangle_arena> _arena;
+	size_t _first;
+	size_t _count;
+#ifdef FLOAT_MESH
+	Point _origin;
+#endif
+	size_t _solid;
+
+#ifdef FLOAT_MESH
+	Stored_triangle store(const Triangle& tr) const { return Stored_triangle(tr, _origin); };
+	bool same_origin(const Face& o) const
+		{
+			return o._origin.x() == _origin.x() && o._origin.y() == _origin.y()
+				&& o._origin.z() == _origin.z();
+		}
+#else
+	const Triangle& store(const Triangle& tr) const { return tr; };
+	bool same_origin(const Face&) const { return true; };
+#endif
+
+	void make_appendable()
+		{
+			if (_arena && _first + _count == _arena->size())
+				return;
+			std::shared_ptr<Triangle_arena> a(new Triangle_arena());
+			if (_arena)
+				a->assign(_arena->begin() + _first, _arena->begin() + _first + _count);
+			_arena = a;
+			_first = 0;
+		}
+
 public:
-	Face() {};
-	void addTriangle(const Triangle& tr) { triangles.push_back(tr); };
+	Face() : _first(0), _count(0), _solid(0) {};
+
+	/* An (empty) face whose triangles will be appended to 'arena' */
+	explicit Face(const std::shared_ptr<Triangle_arena>& arena) :
+		_arena(arena), _first(arena->size()), _count(0), _solid(0) {};
+
+	size_t size() const { return _count; };
+
+	/* Make room for 'count' more triangles */
+	void reserve(size_t count)
+		{
+			make_appendable();
+			const size_t need = _arena->size() + count;
+			if (_arena->capacity() < need)
+				_arena->reserve(std::max(need, _arena->capacity() * 2));
+		}
+
+	void addTriangle(const Triangle& tr)
+		{
+			make_appendable();
+			_arena->push_back(store(tr));
+			++_count;
+		}
+
+#ifdef FLOAT_MESH
+	Triangle operator[](size_t i) const { return (*_arena)[_first + i].get(_origin); };
+
+	/* Points are stored relative to the origin, set it (e.g. to the
+	   center of the part) before adding triangles */
+	const Point& origin() const { return _origin; };
+	void set_origin(const Point& origin)
+		{
+			for (size_t i=0;i<_count;++i) {
+				Stored_triangle &st = (*_arena)[_first + i];
+				st = Stored_triangle(st.get(_origin), origin);
+			}
+			_origin = origin;
+		}
+#else
+	const Triangle& operator[](size_t i) const { return (*_arena)[_first + i]; };
 
+	/* Only used with FLOAT_MESH storage */
+	Point origin() const { return Point(); };
+	void set_origin(const Point&) {};
+#endif
+
+	/* Call fn(Point&) for every point, e.g. to modify them */
+	template<class Fn>
+	void for_each_point(Fn fn)
+		{
+			for (size_t i=0;i<_count;++i) {
+				Stored_triangle &st = (*_arena)[_first + i];
+#ifdef FLOAT_MESH
+				Triangle t = st.get(_origin);
+				t.for_each_point(fn);
+				st = Stored_triangle(t, _origin);
+#else
+				st.for_each_point(fn);
+#endif
+			}
+		}
+
+	/* Append the triangles of another face. Faces which follow each
+	   other in the same arena are merged without copying. */
 	void add_face(const Face& other_face)
 		{
-			triangles.insert(triangles.end(),
-					 other_face.triangles.begin(),
-					 other_face.triangles.end());
+			const Face &o = other_face;
+			if (o._count == 0)
+				return;
+			if (!same_origin(o)) {
+				for (size_t i=0;i<o._count;++i)
+					addTriangle(o[i]);
+				return;
+			}
+			if (_count == 0) {
+				_arena = o._arena;
+				_first = o._first;
+				_count = o._count;
+				return;
+			}
+			if (_arena == o._arena && _first + _count == o._first) {
+				_count += o._count;
+				return;
+			}
+			// By index: 'o' can be in our arena, which reserve() may reallocate
+			reserve(o._count);
+			for (size_t i=0;i<o._count;++i)
+				_arena->push_back((*o._arena)[o._first + i]);
+			_count += o._count;
 		}
 
+	/* Index of the solid containing this face (see tessellate_shape) */
+	size_t solid() const { return _solid; };
+	void set_solid(size_t solid) { _solid = solid; };
+
 	void write_ascii_stl(std::ostream &ostrm) const
 		{
-			for (auto &t : triangles) {
+			write_ascii_stl(ostrm, 0, _count);
+		}
+
+	/* Write triangles [first,last) only */
+	void write_ascii_stl(std::ostream &ostrm, size_t first, size_t last) const
+		{
+			for (size_t i=first;i<last;++i) {
 				ostrm << " facet normal 42 42 42" << std::endl;
 				ostrm << "   outer loop" << std::endl;
-				t.write_ascii_stl(ostrm);
+				(*this)[i].write_ascii_stl(ostrm);
 				ostrm << "   endloop" << std::endl;
 				ostrm << " endfacet" << std::endl;
 			}
@@ -93,31 +311,51 @@ public:
 
 	void write_points_vector(std::ostream &ostrm) const
 		{
-			int i = 1 ;
 			ostrm << "[" << std::endl;
-			for (auto &t : triangles) {
+			write_points_rows(ostrm, 0, _count);
+			ostrm << "];" << std::endl;
+		}
+
+	/* Write the points-vector rows of triangles [first,last) only */
+	void write_points_rows(std::ostream &ostrm, size_t first, size_t last) const
+		{
+			for (size_t i=first+1;i<=last;++i) {
 				ostrm << "  ";
-				t.write_points_vector(ostrm);
+				(*this)[i-1].write_points_vector(ostrm);
 				ostrm << ",";
-				if (i==1 || (i%10==0 && triangles.size()>10))
-					ostrm << " // Triangle " << i << " / " << triangles.size();
+				if (i==1 || (i%10==0 && _count>10))
+					ostrm << " // Triangle " << i << " / " << _count;
 				ostrm << std::endl;
-				++i;
 			}
-			ostrm << "];" << std::endl;
 		}
 
 	void write_face_vector(std::ostream &ostrm) const
 		{
 			ostrm << "[" << std::endl;
-			for (int i=0;i<triangles.size();++i) {
-				int idx = i*3;
+			write_face_rows(ostrm, 0, _count);
+			ostrm << "];" << std::endl;
+		}
+
+	/* The same vector as write_face_vector, as a list comprehension
+	   (a fraction of the size, and much faster for OpenSCAD to parse) */
+	void write_compact_face_vector(std::ostream &ostrm) const
+		{
+			if (_count == 0)
+				ostrm << "[];" << std::endl;
+			else
+				ostrm << "[for (i=[0:" << (_count-1) << "]) [3*i,3*i+1,3*i+2]];" << std::endl;
+		}
+
+	/* Write the faces-vector rows of triangles [first,last) only */
+	void write_face_rows(std::ostream &ostrm, size_t first, size_t last) const
+		{
+			for (size_t i=first;i<last;++i) {
+				size_t idx = i*3;
 				ostrm << "  [" << idx << "," << (idx+1) << "," << (idx+2) << "],";
-				if (i==0 || ((i+1)%10==0 && triangles.size()>10))
-					ostrm << " // Triangle " << (i+1) << " / " << triangles.size();
+				if (i==0 || ((i+1)%10==0 && _count>10))
+					ostrm << " // Triangle " << (i+1) << " / " << _count;
 				ostrm << std::endl;
 			}
-			ostrm << "];" << std::endl;
 		}
 };
 typedef std::vector<Face> Face_vector;
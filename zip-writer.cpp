@@ -0,0 +1,276 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "compressed-input.h"
+#include "compressed-output.h"
+#include "zip-writer.h"
+
+using namespace std;
+
+#define ZIP_LOCAL_HEADER    0x04034b50
+#define ZIP_DATA_DESCRIPTOR 0x08074b50
+#define ZIP_CENTRAL_HEADER  0x02014b50
+#define ZIP64_END_RECORD    0x06064b50
+#define ZIP64_END_LOCATOR   0x07064b50
+#define ZIP_END_RECORD      0x06054b50
+
+#define ZIP_STORED   0
+#define ZIP_DEFLATED 8
+
+// general purpose flag: CRC and sizes are in the data descriptor
+#define ZIP_FLAG_DESCRIPTOR 0x0008
+
+// "version needed to extract": 2.0 (deflate), 4.5 (zip64)
+#define ZIP_VERSION   20
+#define ZIP64_VERSION 45
+
+// DOS date of 1980-01-01 00:00, keeping the output reproducible
+#define ZIP_DOS_TIME 0
+#define ZIP_DOS_DATE 0x0021
+
+#define ZIP_MAX_32 0xFFFFFFFFULL
+#define ZIP_MAX_16 0xFFFF
+
+/* Little-endian field encoding */
+static void put16(string& s, unsigned long long v)
+{
+	s += (char)(v & 0xFF);
+	s += (char)((v >> 8) & 0xFF);
+}
+
+static void put32(string& s, unsigned long long v)
+{
+	put16(s, v & 0xFFFF);
+	put16(s, (v >> 16) & 0xFFFF);
+}
+
+static void put64(string& s, unsigned long long v)
+{
+	put32(s, v & 0xFFFFFFFFULL);
+	put32(s, v >> 32);
+}
+
+Zip_writer::Zip_writer(std::streambuf* sink) :
+	_sink(sink), _pos(0), _compressor(NULL), _failed(false)
+{
+}
+
+Zip_writer::~Zip_writer()
+{
+	delete _compressor;
+}
+
+void Zip_writer::write(const std::string& data)
+{
+	if (_sink->sputn(data.data(), data.size()) != (streamsize)data.size())
+		_failed = true;
+	_pos += data.size();
+}
+
+void Zip_writer::write_local_header(const Entry& e, unsigned flags)
+{
+	const bool descriptor = (flags & ZIP_FLAG_DESCRIPTOR) != 0;
+
+	string h;
+	put32(h, ZIP_LOCAL_HEADER);
+	put16(h, e.zip64 ? ZIP64_VERSION : ZIP_VERSION);
+	put16(h, flags);
+	put16(h, e.method);
+	put16(h, ZIP_DOS_TIME);
+	put16(h, ZIP_DOS_DATE);
+	put32(h, descriptor ? 0 : e.crc);
+	if (e.zip64) {
+		// the real sizes are in the zip64 extra field (or the descriptor)
+		put32(h, ZIP_MAX_32);
+		put32(h, ZIP_MAX_32);
+	} else {
+		put32(h, descriptor ? 0 : e.compressed);
+		put32(h, descriptor ? 0 : e.uncompressed);
+	}
+	put16(h, e.name.size());
+	put16(h, e.zip64 ? 20 : 0);
+	h += e.name;
+	if (e.zip64) {
+		put16(h, 0x0001);
+		put16(h, 16);
+		put64(h, descriptor ? 0 : e.uncompressed);
+		put64(h, descriptor ? 0 : e.compressed);
+	}
+	write(h);
+}
+
+bool Zip_writer::add_file(const std::string& name, const std::string& data)
+{
+	Entry e;
+	e.name = name;
+	e.method = ZIP_STORED;
+	e.crc = crc32(crc32(0, NULL, 0), (const Bytef*)data.data(), (uInt)data.size());
+	e.compressed = e.uncompressed = data.size();
+	e.offset = _pos;
+	e.zip64 = false;
+
+	write_local_header(e, 0);
+	write(data);
+	_entries.push_back(e);
+	return !_failed;
+}
+
+std::streambuf* Zip_writer::begin_entry(const std::string& name, bool zip64)
+{
+	Entry e;
+	e.name = name;
+	e.method = ZIP_DEFLATED;
+	e.crc = 0;
+	e.compressed = e.uncompressed = 0;
+	e.offset = _pos;
+	e.zip64 = zip64;
+
+	write_local_header(e, ZIP_FLAG_DESCRIPTOR);
+	_entries.push_back(e);
+
+	delete _compressor;
+	_compressor = new Compressing_streambuf(_sink, COMPRESSION_DEFLATE);
+	return _compressor;
+}
+
+bool Zip_writer::end_entry()
+{
+	if (!_compressor)
+		return false;
+
+	if (!_compressor->finish())
+		_failed = true;
+
+	Entry &e = _entries.back();
+	e.crc = _compressor->input_crc();
+	e.uncompressed = _compressor->input_size();
+	e.compressed = _compressor->output_size();
+	_pos += e.compressed;
+	delete _compressor;
+	_compressor = NULL;
+
+	if (!e.zip64 && (e.compressed >= ZIP_MAX_32 || e.uncompressed >= ZIP_MAX_32)) {
+		cerr << "Zip entry '" << e.name << "' is too large (over 4GB)" << endl;
+		_failed = true;
+	}
+
+	string d;
+	put32(d, ZIP_DATA_DESCRIPTOR);
+	put32(d, e.crc);
+	if (e.zip64) {
+		put64(d, e.compressed);
+		put64(d, e.uncompressed);
+	} else {
+		put32(d, e.compressed);
+		put32(d, e.uncompressed);
+	}
+	write(d);
+	return !_failed;
+}
+
+bool Zip_writer::finish()
+{
+	if (_compressor)
+		end_entry();
+
+	const unsigned long long cd_offset = _pos;
+	bool need_zip64 = _entries.size() >= ZIP_MAX_16;
+
+	for (auto &e : _entries) {
+		const bool big_offset = e.offset >= ZIP_MAX_32;
+
+		string extra;
+		if (e.zip64 || big_offset) {
+			string fields;
+			if (e.zip64) {
+				put64(fields, e.uncompressed);
+				put64(fields, e.compressed);
+			}
+			if (big_offset)
+				put64(fields, e.offset);
+			put16(extra, 0x0001);
+			put16(extra, fields.size());
+			extra += fields;
+			need_zip64 = true;
+		}
+
+		const unsigned version = (e.zip64 || big_offset) ? ZIP64_VERSION : ZIP_VERSION;
+		string h;
+		put32(h, ZIP_CENTRAL_HEADER);
+		put16(h, version);     // version made by
+		put16(h, version);     // version needed
+		put16(h, e.method == ZIP_DEFLATED ? ZIP_FLAG_DESCRIPTOR : 0);
+		put16(h, e.method);
+		put16(h, ZIP_DOS_TIME);
+		put16(h, ZIP_DOS_DATE);
+		put32(h, e.crc);
+		put32(h, e.zip64 ? ZIP_MAX_32 : e.compressed);
+		put32(h, e.zip64 ? ZIP_MAX_32 : e.uncompressed);
+		put16(h, e.name.size());
+		put16(h, extra.size());
+		put16(h, 0);           // comment length
+		put16(h, 0);           // disk number
+		put16(h, 0);           // internal attributes
+		put32(h, 0);           // external attributes
+		put32(h, big_offset ? ZIP_MAX_32 : e.offset);
+		h += e.name;
+		h += extra;
+		write(h);
+	}
+
+	const unsigned long long cd_size = _pos - cd_offset;
+	if (cd_offset >= ZIP_MAX_32 || cd_size >= ZIP_MAX_32)
+		need_zip64 = true;
+
+	string t;
+	if (need_zip64) {
+		const unsigned long long record_offset = _pos;
+		put32(t, ZIP64_END_RECORD);
+		put64(t, 44);          // size of the remaining record
+		put16(t, ZIP64_VERSION);
+		put16(t, ZIP64_VERSION);
+		put32(t, 0);
+		put32(t, 0);
+		put64(t, _entries.size());
+		put64(t, _entries.size());
+		put64(t, cd_size);
+		put64(t, cd_offset);
+
+		put32(t, ZIP64_END_LOCATOR);
+		put32(t, 0);
+		put64(t, record_offset);
+		put32(t, 1);           // number of disks
+	}
+
+	put32(t, ZIP_END_RECORD);
+	put16(t, 0);
+	put16(t, 0);
+	put16(t, need_zip64 ? ZIP_MAX_16 : _entries.size());
+	put16(t, need_zip64 ? ZIP_MAX_16 : _entries.size());
+	put32(t, need_zip64 ? ZIP_MAX_32 : cd_size);
+	put32(t, need_zip64 ? ZIP_MAX_32 : cd_offset);
+	put16(t, 0);           // comment length
+	write(t);
+
+	if (_sink->pubsync() != 0)
+		_failed = true;
+	if (_failed)
+		cerr << "Failed to write zip output" << endl;
+	return !_failed;
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2019 Assaf Gordon <assafgordon@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Lesser General Public License for more details.
+ */
+#ifndef __ZIP_WRITER__
+#define __ZIP_WRITER__
+
+#include <cstddef>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+class Compressing_streambuf;
+
+/* Writes a zip archive to a stream buffer, without seeking
+   (so the output can be a pipe).
+
+   - add_file() adds a small entry, stored uncompressed.
+   - begin_entry()/end_entry() add a streamed entry: the data written to
+     the returned stream buffer is deflated on a separate thread, and its
+     CRC and sizes follow in a data descriptor.
+
+   Zip64 records are used for entries/archives larger than 4GB;
+   streamed entries must declare this up-front (begin_entry's 'zip64'),
+   since their local header is written before their size is known. */
+class Zip_writer {
+	struct Entry {
+		std::string name;
+		unsigned method;
+		unsigned long crc;
+		unsigned long long compressed;
+		unsigned long long uncompressed;
+		unsigned long long offset;
+		bool zip64;
+	};
+
+	std::streambuf* _sink;
+	std::vector<Entry> _entries;
+	unsigned long long _pos;
+	Compressing_streambuf* _compressor;
+	bool _failed;
+
+	Zip_writer(const Zip_writer&);
+	Zip_writer& operator=(const Zip_writer&);
+
+	void write(const std::string& data);
+	void write_local_header(const Entry& e, unsigned flags);
+
+public:
+	Zip_writer(std::streambuf* sink);
+	~Zip_writer();
+
+	bool add_file(const std::string& name, const std::string& data);
+
+	/* Returns the stream buffer to write the entry's data into,
+	   valid until end_entry(). */
+	std::streambuf* begin_entry(const std::string& name, bool zip64);
+	bool end_entry();
+
+	/* Write the central directory. Returns false (and prints an error
+	   to STDERR) if anything failed. */
+	bool finish();
+};
+
+#endif